@@ -0,0 +1,146 @@
+#!/bin/bash
+# DTNEX CGR benchmark
+# Measures how the contact plans created by dtnex affect ION route computation and bundle forwarding
+# Needs a running local ION node, all benchmark contacts are removed again at the end of every run
+
+#Numbers of links of the generated topologies
+planSizes="50 100 200 500 1000"
+#Every link is installed this many times in the "nodiff" scenario (contacts re-added without diffing)
+duplicates=4
+#Extra links (in percent of the plan size) in the "noaging" and "nopruning" scenarios
+extraLinks=50
+#Number of destinations used to measure route computation
+destinations=10
+#Duration (in seconds) of the generated contacts, as installed by dtnex
+contactDuration=3600000
+#Generated nodes are numbered from here on, so they do not clash with real nodes
+firstNode=900000
+#Seed of the random topologies, the same seed gives the same plans
+seed=1
+resultFile=cgrbench.csv
+
+#Scenarios: baseline (dtnex with diffing, aging and pruning), nodiff, noaging, nopruning
+scenarios="baseline nodiff noaging nopruning"
+
+echo "Starting a DTNEX CGR benchmark..."
+
+localEID=$(echo "l endpoint"|bpadmin|grep -E -o "\bipn+:[0-9]+\.[0-9]+\b"|head -1)
+nodeId=${localEID#ipn:}
+nodeId=${nodeId%%.*}
+if [ -z "$nodeId" ]; then
+	echo "$(tput setaf 1)No local ION node found, start ION first!$(tput setaf 7)"
+	exit 1
+fi
+echo "$(tput setaf 3)Local Node ID:$nodeId$(tput setaf 7)"
+if ! command -v cgrfetch >/dev/null; then
+	echo "$(tput setaf 1)cgrfetch not found, route computation is not measured$(tput setaf 7)"
+fi
+
+workDir=$(mktemp -d)
+trap "rm -rf $workDir" EXIT
+
+#Time (in ms) since $1 (a value of ${EPOCHREALTIME/[.,]/})
+elapsedMs() {
+	echo $(( (${EPOCHREALTIME/[.,]/}-$1)/1000 ))
+}
+
+#Writes the ION commands of link $1-$2 to the plan, as installed by dtnex (contact window $3 to $4)
+addLink() {
+	echo "a contact $3 $4 $1 $2 100000"
+	echo "a contact $3 $4 $2 $1 100000"
+	echo "a range $3 $4 $1 $2 1"
+	echo "a range $3 $4 $2 $1 1"
+}
+
+#Writes the plan of scenario $1 with $2 links to $workDir/plan and the used node pairs to $workDir/pairs
+#The topology is a random tree rooted at the local node, its leaves are used as destinations
+buildPlan() {
+	local scenario=$1 size=$2 i parent node k extra
+	local -a parents
+	RANDOM=$seed
+	>$workDir/pairs
+	>$workDir/leaves
+	parents=($nodeId)
+	for ((i=0; i<size; i++)); do
+		node=$((firstNode+i))
+		parent=${parents[$((RANDOM % ${#parents[@]}))]}
+		parents+=($node)
+		echo "$parent $node">>$workDir/pairs
+	done
+	extra=$((size*extraLinks/100))
+	if [ "$scenario" == "noaging" ]; then
+		#Expired links that are still installed, attached to the live tree
+		for ((i=0; i<extra; i++)); do
+			echo "${parents[$((RANDOM % ${#parents[@]}))]} $((firstNode+size+i))">>$workDir/pairs
+		done
+	elif [ "$scenario" == "nopruning" ]; then
+		#Links between nodes that can not be reached from the local node
+		for ((i=1; i<extra; i++)); do
+			echo "$((firstNode+size+RANDOM % i)) $((firstNode+size+i))">>$workDir/pairs
+		done
+	fi
+	awk '{child[$2]=1; if ($1 != '"$nodeId"') parent[$1]=1} END {for (n in child) if (!(n in parent)) print n}' <(head -$size $workDir/pairs)|sort -n|head -$destinations>$workDir/leaves
+	while read -r a b; do
+		if [ "$scenario" == "nodiff" ]; then
+			#Without diffing every refresh adds another contact window
+			for ((k=0; k<duplicates; k++)); do
+				addLink $a $b +$((k*contactDuration/duplicates+1)) +$(((k+1)*contactDuration/duplicates))
+			done
+		else
+			addLink $a $b +1 +$contactDuration
+		fi
+	done<$workDir/pairs>$workDir/plan
+}
+
+#Removes all contacts and ranges of the benchmark pairs from ION
+removePlan() {
+	while read -r a b; do
+		echo "d contact * $a $b"
+		echo "d contact * $b $a"
+		echo "d range * $a $b"
+		echo "d range * $b $a"
+	done<$workDir/pairs|ionadmin>/dev/null
+}
+
+echo "scenario,links,contacts,install_ms,cgr_ms_per_route,remove_ms">$resultFile
+for size in $planSizes; do
+	for scenario in $scenarios; do
+		buildPlan $scenario $size
+		contacts=$(grep -c '^a contact' $workDir/plan)
+
+		start=${EPOCHREALTIME/[.,]/}
+		ionadmin<$workDir/plan>/dev/null
+		installMs=$(elapsedMs $start)
+
+		#Route computation, cgrfetch runs CGR from the local node to the destination
+		cgrMs="-"
+		if command -v cgrfetch >/dev/null; then
+			start=${EPOCHREALTIME/[.,]/}
+			while read -r dest; do
+				(cd $workDir && cgrfetch $dest>/dev/null 2>&1)
+			done<$workDir/leaves
+			cgrMs=$(( $(elapsedMs $start)/$(wc -l <$workDir/leaves) ))
+		fi
+
+		#Bundle sending is not timed: bpsource returns when ION accepted the bundle, the route computation
+		#and forwarding happen later in ipnfw, so its time does not depend on the plan size
+
+		start=${EPOCHREALTIME/[.,]/}
+		removePlan
+		removeMs=$(elapsedMs $start)
+
+		echo "$(tput setaf 2)Scenario:$scenario, links:$size, contacts:$contacts, install:${installMs}ms, route computation:${cgrMs}ms, removal:${removeMs}ms$(tput setaf 7)"
+		echo "$scenario,$size,$contacts,$installMs,$cgrMs,$removeMs">>$resultFile
+	done
+done
+
+#What each dtnex feature buys back, measured on the largest plan: cost without the feature relative to the baseline
+echo "$(tput setaf 3)Cost without the feature, relative to the baseline (largest plan):$(tput setaf 7)"
+awk -F, -v size=${planSizes##* } '$2 == size {install[$1]=$4; cgr[$1]=$5} END {
+	for (s in install) if (s != "baseline") {
+		line=sprintf("%s: install x%.2f", s, install[s]/(install["baseline"] ? install["baseline"] : 1))
+		if (cgr[s] != "-") line=line sprintf(", route computation x%.2f", cgr[s]/(cgr["baseline"] ? cgr["baseline"] : 1))
+		print line
+	}
+}' $resultFile
+echo "Results written to $resultFile"
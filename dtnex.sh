@@ -6,13 +6,149 @@
 #Update time in seconds
 updateInterval=60
 
+#Links that are not refreshed within this time (in seconds) are removed from the link database
+linkLifetime=$((3*updateInterval))
+#Neighbor node numbers of links that never change (e.g. fibre backhauls), separated by spaces
+#Static links are advertised with a validity of staticLinkLifetime seconds and refreshed only every staticRefreshInterval seconds
+staticLinks=""
+staticLinkLifetime=86400
+staticRefreshInterval=3600
+#Loop interval (in seconds) used right after a partition heal, while link databases are synchronized
+syncInterval=5
+
+#Only links connected to the local node by some path are installed into ION, unreachable learned links are removed from it
+pruneUnreachable=true
+#Only links within this many hops of the local node are installed into ION (0 installs all links)
+#A node further away is installed as one summary link from its ancestor at this hop distance
+installHopLimit=0
+#Duration (in seconds) of the contacts and ranges installed into ION
+contactDuration=3600000
+#Changes of links within this many hops of the local node are applied to ION before the more distant ones
+priorityHops=2
+#Contacts configured by the operator, imported at startup from this ionrc file, empty imports none
+#dtnex never replaces or deletes operator contacts, learned contacts overlapping them are not installed
+operatorContacts=""
+
+#Flap damping of unstable links, a link gets flapPenalty every time it goes down and the penalty halves every flapHalfLife seconds
+#A link is suppressed when its penalty exceeds flapSuppressLimit and used again when the penalty decays below flapReuseLimit
+#Suppressed links are not installed into ION and are advertised only every flapSuppressedInterval seconds (0 holds them down)
+flapDamping=true
+flapPenalty=1000
+flapSuppressLimit=2000
+flapReuseLimit=750
+flapMaxPenalty=12000
+flapHalfLife=900
+flapSuppressedInterval=0
+
+#bpsink prints a received payload only when it is shorter than 80 bytes, longer bundles never reach the script.
+#Batches are kept within maxPayload bytes, a message that does not fit into one bundle is sent in fragments (see README)
+maxPayload=79
+
+#Received messages are passed from bpsink through a named pipe in this shared memory directory instead of the capture file,
+#and messages arriving during the sleep are processed (and forwarded) right away, empty uses the capture file
+receiveRingDir=""
+
+#Records sent to one neighbor per loop (0 sends all), the records over the budget wait for the next loop
+#Queued records are sent round robin across their origins (deficit round robin), so one busy origin can not hold back
+#the others. The share of an origin is weighted by originWeights: own records, origins within priorityHops hops, farther origins
+neighborBudget=0
+originWeights="4 2 1"
+
+#Counters of received and rejected DTNEX messages are written to this file every loop
+metricsFile=dtnexmetrics
+#Latency histogram buckets (in ms) of the calls of ION tools, calls slower than ionSlowCallMs are reported
+ionLatencyBuckets="1 2 5 10 20 50 100 200 500 1000 2000 5000"
+ionSlowCallMs=1000
+
+#Designated flooder election for neighbors sharing one multi-access segment (e.g. UDP broadcast LAN)
+#Only the elected flooder re-forwards messages to the other nodes on the segment
+designatedFlooding=true
+#Election priority advertised in hellos, highest priority wins (lowest node number on a tie), 0 never becomes the flooder
+flooderPriority=1
+#Segment neighbors are detected from the plan IP addresses and local subnets, list node numbers here to override the detection
+segmentNeighbors=""
+
+#Executables (or named pipes) in this directory get batches of topology changes on their standard input (see README)
+hookDir=hooks
+#Minimum time (in seconds) between two calls of the same hook, changes are coalesced in between
+hookMinInterval=10
+#Maximum number of changes queued per hook, the oldest changes are dropped when the queue is full
+hookQueueMax=1000
+
+#Local publish API, other processes append link records and scheduled contacts to this file (see README)
+publishPipe=publishpipe
+#Maximum number of published records accepted per loop, further records are dropped
+publishMaxRecords=100
+#Snapshots of the neighbor, contact and policy tables are published in this directory for other processes (see README), empty disables them
+snapshotDir=dtnexstate
+#Result of every contact plan compaction ("./dtnex.sh compact") is appended to this file
+compactReport=dtnexcompact
+
+#Node information sent to the other nodes and shown in the graph, leave a value empty to skip it
+nodeName=""
+nodeLocation="" #latitude,longitude
+nodeRole=""
+#Node information version is kept in this file, it is increased whenever the node information changes
+nodeInfoFile=dtnexnodeinfo
+
+#Authoritative contact schedule (e.g. ground station passes computed by mission control), see README
+#Node number of the schedule authority, schedule records of other origins are dropped, empty disables the schedule
+scheduleAuthority=""
+#Public key (PEM) of the authority, schedule records are installed and forwarded only when their signature verifies with it
+scheduleKey=""
+#On the authority: private key used to sign the schedule, and the schedule file with "start end nodeA nodeB [rate]" lines
+scheduleSigningKey=""
+scheduleFile=""
+#On the authority: changes are sent as deltas, the full schedule is sent every scheduleSnapshotInterval seconds
+scheduleSnapshotInterval=3600
+#On the authority: version and content of the last sent schedule are kept in this file
+scheduleStateFile=dtnexschedule
+
+#Position of mobile nodes, "gpsd" reads it from gpsd (gpspipe), a file name reads "lat lon [alt speed track climb]" from that file
+#(degrees, meters, m/s, degrees from north), empty sends no position
+positionSource=""
+#Positions are not used any more when they are older than this (in seconds)
+positionLifetime=$((5*updateInterval))
+#Contact windows are predicted from the positions of all nodes for this many seconds ahead, in steps of predictionStep seconds
+#and installed into ION as scheduled contacts, with a radio range (in meters) of linkRange or "nodeA-nodeB:range" from linkRanges
+positionPrediction=true
+predictionHorizon=600
+predictionStep=10
+linkRange=1000
+linkRanges=""
+predictedRate=100000
+
+#Fixed capacity profile for very small nodes (e.g. Pi Zero), the tables never grow beyond the sizes below
+#and the startup fails when their worst case memory use exceeds memoryBudgetKB
+fixedCapacity=false
+declare -r maxLinks=512 #link database entries
+declare -r maxSeenMessages=1536 #duplicate detection entries
+declare -r maxScheduledContacts=256 #scheduled contact entries
+declare -r maxQueuedMessages=64 #queued messages per neighbor
+declare -r maxNodes=128 #nodes with cached position, node information and queue delay statistics, origins tracked for partitions
+declare -r maxFlapPairs=256 #links with a flap penalty
+declare -r maxScheduleRecords=8 #authoritative schedule records kept for new neighbors, and early deltas
+declare -r maxFragments=160 #received fragments waiting for the rest of their message (a full schedule of maxScheduledContacts needs about 140)
+memoryBudgetKB=1024
+
 #Use this definition if you want to visualize the contact graph plan (Note:graphviz tool needs to be installed on the system)
 createGraph=true
 graphFile=/home/pi/.node-red/lib/ui-media/lib/DTN/dtnGraph.png
 
 
 
-echo "Starting a DTNEX script, author: Samo Grasic (samo@grasic.net), v0.4 ..."
+#"./dtnex.sh compact" asks the running script to compact the ION contact plan
+if [ "$1" == "compact" ]; then
+	if [ ! -p $publishPipe ] || ! timeout 5 sh -c 'echo compact>>"$1"' _ $publishPipe; then
+		echo "$(tput setaf 1)DTNEX is not running, no compaction requested$(tput setaf 7)"
+		exit 1
+	fi
+	echo "Contact plan compaction requested, the report is written to $compactReport"
+	exit 0
+fi
+
+dtnexVersion=0.4
+echo "Starting a DTNEX script, author: Samo Grasic (samo@grasic.net), v$dtnexVersion ..."
 
 serviceNr=12160 #Do not change
 msgidentifier="xmsg"
@@ -23,21 +159,1876 @@ rm $capturePipe
 touch $capturePipe
 chmod 644 $capturePipe
 
+#Published records are passed through a named pipe, it is opened for reading and writing so producers never block
+#while the script runs, and a record can not be lost between reading and clearing a file
+rm -f $publishPipe
+mkfifo $publishPipe
+exec 5<>$publishPipe
+if [ -n "$snapshotDir" ]; then
+	mkdir -p $snapshotDir
+fi
+
+receivedMsgCount=0
+rejectedMsgCount=0
+publishedCount=0
+publishRejectedCount=0
+publishDroppedCount=0
+capacityDropCount=0
+scheduleRejectedCount=0
+supersededCount=0
+
+#Approximate bytes used by one entry of each table (queues counted for 32 neighbors), used to check the fixed capacity profile against the memory budget
+if [ "$fixedCapacity" == "true" ]; then
+	#Schedule records are counted with a full schedule each, the duplicate table with its insertion order ring
+	#and the link database with its expiry index
+	worstCaseKB=$(( (maxLinks*240 + maxLinks*40 + maxSeenMessages*(96+64) + maxScheduledContacts*160 + maxQueuedMessages*(128+16)*32 + hookQueueMax*48 \
+		+ maxNodes*(96+160+96+64) + maxFlapPairs*128 + maxScheduleRecords*2*(maxScheduledContacts*32+160) + maxFragments*160)/1024 ))
+	echo "Fixed capacity profile, worst case table memory:${worstCaseKB}KB, budget:${memoryBudgetKB}KB"
+	if (( worstCaseKB > memoryBudgetKB )); then
+		echo "$(tput setaf 1)Table capacities exceed the memory budget, reduce the max* values!$(tput setaf 7)"
+		exit 1
+	fi
+fi
+
+#Every sent DTNEX message ends with a "#<crc>" field, a CRC-32 (cksum) of the message text before it
+msgChecksum() {
+	local crc
+	read -r crc _ < <(printf '%s' "$1"|cksum)
+	echo "$crc"
+}
+
+appendChecksum() {
+	echo "$1 #$(msgChecksum "$1")"
+}
+
+#ION interaction profiler, per operation: number of calls, total time (in ms), errors and histogram "op bucket" -> calls
+declare -A ionOpCount
+declare -A ionOpTime
+declare -A ionOpErrors
+declare -A ionOpBucket
+#ION admin commands sent by updateContactPlan, per kind (e.g. "a contact")
+declare -A ionCommandCount
+
+#Calls ION tool $2 (with arguments $3...) on the standard input of the caller and keeps its output in ionReply
+#The call is timed as operation $1, a non zero exit code or an ION error line ("[?]") counts as an error
+ionCall() {
+	local op=$1 start ms le status
+	shift
+	start=${EPOCHREALTIME/[.,]/}
+	ionReply=$("$@")
+	status=$?
+	ms=$(( (${EPOCHREALTIME/[.,]/}-start)/1000 ))
+	((ionOpCount[$op]++))
+	((ionOpTime[$op]+=ms))
+	if [ $status -ne 0 ] || [[ "$ionReply" == *"[?]"* ]]; then
+		((ionOpErrors[$op]++))
+		echo "$(tput setaf 1)ION call $op failed (exit code $status)$(tput setaf 7)"
+	fi
+	if (( ms >= ionSlowCallMs )); then
+		echo "$(tput setaf 1)Slow ION call $op:${ms}ms$(tput setaf 7)"
+	fi
+	#Buckets are cumulative, as in Prometheus histograms
+	for le in $ionLatencyBuckets; do
+		if (( ms <= le )); then
+			((ionOpBucket["$op $le"]++))
+		fi
+	done
+	return $status
+}
+
+#Appends the ION interaction profile to the metrics file
+writeIonMetrics() {
+	local op le kind
+	for op in "${!ionOpCount[@]}"; do
+		for le in $ionLatencyBuckets; do
+			echo "dtnex_ion_call_duration_ms_bucket{op=\"$op\",le=\"$le\"} ${ionOpBucket["$op $le"]:-0}"
+		done
+		echo "dtnex_ion_call_duration_ms_bucket{op=\"$op\",le=\"+Inf\"} ${ionOpCount[$op]}"
+		echo "dtnex_ion_call_duration_ms_sum{op=\"$op\"} ${ionOpTime[$op]}"
+		echo "dtnex_ion_call_duration_ms_count{op=\"$op\"} ${ionOpCount[$op]}"
+		echo "dtnex_ion_call_errors_total{op=\"$op\"} ${ionOpErrors[$op]:-0}"
+	done>>$metricsFile
+	for kind in "${!ionCommandCount[@]}"; do
+		echo "dtnex_ion_commands_total{command=\"$kind\"} ${ionCommandCount[$kind]}"
+	done>>$metricsFile
+}
+
+#Message versions and features advertised to neighbors in hello messages
+#batch: several messages in one bundle, gz: compressed batches
+supportedVersions="1"
+supportedFeatures="crc,batch,gz,digest,ct,na,po"
+if [ -n "$scheduleAuthority" ]; then
+	supportedFeatures+=",sc"
+fi
+if [ "$designatedFlooding" == "true" ]; then
+	supportedFeatures+=",dr"
+fi
+
+#Neighbor capabilities learned from received hello messages
+declare -A neighborFeatures
+declare -A neighborHelloTime
+declare -A neighborPriority
+
+neighborSupports() {
+	if [ -z "${neighborFeatures[$1]}" ] || (( SECONDS - ${neighborHelloTime[$1]} > 3*updateInterval )); then
+		return 1
+	fi
+	[[ ",${neighborFeatures[$1]}," == *",$2,"* ]]
+}
+
+#Messages are queued per neighbor and origin during the loop and sent out by flushQueues
+#A message that needs a feature ($3) is only queued for neighbors supporting it
+#outQueue: "neighbor origin" -> messages separated by ";", outQueueTimes: their queue times (in ms)
+declare -A outQueue
+declare -A outQueueTimes
+declare -A outQueueCount
+#Deficit of every queue and last served origin of every neighbor, both carried to the next flush
+declare -A originDeficit
+declare -A lastServedOrigin
+#Records sent to every neighbor in this loop
+declare -A neighborSent
+#Queue delay (in ms) of the sent records, per origin
+declare -A originDelaySum
+declare -A originDelayCount
+declare -A originDelayMax
+
+queueMessage() {
+	local type origin from a b prefix queue before after
+	if [ -n "$3" ] && ! neighborSupports $1 $3; then
+		return
+	fi
+	#A newer link, position or hello record of the same origin replaces the queued one, it keeps its place in the queue
+	read -r _ _ type origin from a b _ <<< "$2"
+	if [ "$type" == "li" ]; then
+		prefix="$msgidentifier 1 li $origin $from $a $b "
+	elif [ "$type" == "po" ] || [ "$type" == "hi" ]; then
+		prefix="$msgidentifier 1 $type $origin "
+	fi
+	if [ -n "$prefix" ] && [[ ";${outQueue["$1 $origin"]}" == *";$prefix"* ]]; then
+		queue=";${outQueue["$1 $origin"]};"
+		before=${queue%%";$prefix"*}
+		after=${queue#"$before;$prefix"}
+		after=${after#*;}
+		queue="$before;$2;$after"
+		queue=${queue#;}
+		outQueue["$1 $origin"]=${queue%;}
+		((supersededCount++))
+		return
+	fi
+	if [ "$fixedCapacity" == "true" ] && (( ${outQueueCount[$1]:-0} >= maxQueuedMessages )); then
+		((capacityDropCount++))
+		return
+	fi
+	((outQueueCount[$1]++))
+	if [ -n "${outQueue["$1 $origin"]}" ]; then
+		outQueue["$1 $origin"]+=";$2"
+	else
+		outQueue["$1 $origin"]=$2
+	fi
+	outQueueTimes["$1 $origin"]+=" $((${EPOCHREALTIME/[.,]/}/1000))"
+}
+
+#Queue delay and backlog of the outbound records per origin, in Prometheus format
+writeOriginMetrics() {
+	local origin key queue
+	local -A backlog
+	for key in "${!outQueue[@]}"; do
+		queue=${outQueue[$key]//[^;]/}
+		((backlog[${key#* }]+=${#queue}+1))
+	done
+	for origin in "${!originDelayCount[@]}"; do
+		echo "dtnex_origin_queue_delay_ms_sum{origin=\"$origin\"} ${originDelaySum[$origin]}"
+		echo "dtnex_origin_queue_delay_ms_count{origin=\"$origin\"} ${originDelayCount[$origin]}"
+		echo "dtnex_origin_queue_delay_ms_max{origin=\"$origin\"} ${originDelayMax[$origin]}"
+	done>>$metricsFile
+	for origin in "${!backlog[@]}"; do
+		echo "dtnex_origin_queued_records{origin=\"$origin\"} ${backlog[$origin]}"
+	done>>$metricsFile
+}
+
+#Sets weight to the deficit round robin quantum of origin $1
+originWeight() {
+	local -a weights=($originWeights)
+	if [ "$1" == "$nodeId" ]; then
+		weight=${weights[0]}
+	elif [ -n "${nodeDepth[$1]}" ] && (( ${nodeDepth[$1]} <= priorityHops )); then
+		weight=${weights[1]}
+	else
+		weight=${weights[2]}
+	fi
+}
+
+#Takes the records for neighbor $1 from its origin queues by deficit round robin, at most $2 records, into msgs
+#Every round adds the weight of an origin to its deficit, and the origin sends one record per unit of deficit
+takeRecords() {
+	local key origin queue rest time now budget=$2 i
+	local -a origins active
+	now=$((${EPOCHREALTIME/[.,]/}/1000))
+	for key in "${!outQueue[@]}"; do
+		if [[ "$key" == "$1 "* ]]; then
+			origins+=(${key#* })
+		fi
+	done
+	#Rounds start after the origin served last, so a budget that ends within a round does not favor the first origins
+	origins=($(printf '%s\n' "${origins[@]}"|sort -n))
+	for ((i=0; i<${#origins[@]}; i++)); do
+		if (( ${origins[$i]} > ${lastServedOrigin[$1]:--1} )); then
+			break
+		fi
+	done
+	origins=("${origins[@]:i}" "${origins[@]:0:i}")
+	while (( budget > 0 && ${#origins[@]} > 0 )); do
+		active=()
+		for origin in "${origins[@]}"; do
+			key="$1 $origin"
+			if (( budget > 0 )); then
+				originWeight $origin
+				originDeficit[$key]=$(( ${originDeficit[$key]:-0}+weight ))
+			fi
+			while (( budget > 0 && ${originDeficit[$key]:-0} > 0 )) && [ -n "${outQueue[$key]}" ]; do
+				queue=${outQueue[$key]}
+				msgs+=("${queue%%;*}")
+				if [[ "$queue" == *";"* ]]; then
+					outQueue[$key]=${queue#*;}
+				else
+					outQueue[$key]=""
+				fi
+				rest=${outQueueTimes[$key]# }
+				time=${rest%% *}
+				outQueueTimes[$key]=${rest#$time}
+				if [ "$fixedCapacity" != "true" ] || [ -n "${originDelayCount[$origin]}" ] || (( ${#originDelayCount[@]} < maxNodes )); then
+					((originDelaySum[$origin]+=now-time))
+					((originDelayCount[$origin]++))
+					if (( now-time > ${originDelayMax[$origin]:-0} )); then
+						originDelayMax[$origin]=$((now-time))
+					fi
+				fi
+				originDeficit[$key]=$(( ${originDeficit[$key]}-1 ))
+				lastServedOrigin[$1]=$origin
+				((budget--))
+			done
+			#An emptied queue loses its deficit
+			if [ -z "${outQueue[$key]}" ]; then
+				unset outQueue["$key"] outQueueTimes["$key"] originDeficit["$key"]
+			else
+				active+=($origin)
+			fi
+		done
+		origins=("${active[@]}")
+	done
+}
+
+#Sends payload $2 to neighbor $1, a payload that does not fit into one bundle together with its checksum is split into
+#fragments "xmsg 1 fr <origin> <from> <id> <index> <count> <part>", every fragment with its own checksum.
+#Nodes that do not know fragments ignore them like any unknown message.
+fragmentId=$RANDOM
+sendPayload() {
+	local msg prefix size count digits i
+	msg=$(appendChecksum "$2")
+	if (( ${#msg} <= maxPayload )); then
+		ionCall bundle_send bpsource ipn:$1.$serviceNr "$msg"
+		return
+	fi
+	fragmentId=$(( (fragmentId+1) % 100000 ))
+	prefix="$msgidentifier 1 fr $nodeId $nodeId $fragmentId"
+	#Room for the index and count fields (as many digits as the count needs, up to 3) and the longest checksum
+	for digits in 1 2 3; do
+		size=$((maxPayload-${#prefix}-2*digits-3-12))
+		count=$(( size > 0 ? (${#2}+size-1)/size : 1000 ))
+		if (( count < 10**digits )); then
+			break
+		fi
+	done
+	if (( count > 999 )); then
+		echo "$(tput setaf 1)Message too long for $maxPayload byte bundles, not sent to node $1$(tput setaf 7)"
+		return
+	fi
+	for ((i=0; i<count; i++)); do
+		ionCall bundle_send bpsource ipn:$1.$serviceNr "$(appendChecksum "$prefix $((i+1)) $count ${2:i*size:size}")"
+	done
+}
+
+#Sends batch $2 to neighbor $1, compressed when that is shorter
+sendBatch() {
+	local packed
+	if neighborSupports $1 gz; then
+		packed="$msgidentifier 1 gz $(printf '%s' "$2"|gzip -9n|base64 -w0)"
+		if (( ${#packed} < ${#2} )); then
+			sendPayload $1 "$packed"
+			return
+		fi
+	fi
+	sendPayload $1 "$2"
+}
+
+flushQueues() {
+	local node key msg body budget
+	local -a msgs
+	local -A nodes
+	for key in "${!outQueue[@]}"; do
+		nodes[${key%% *}]=1
+	done
+	for node in "${!nodes[@]}"; do
+		budget=${outQueueCount[$node]}
+		if (( neighborBudget > 0 && neighborBudget-${neighborSent[$node]:-0} < budget )); then
+			budget=$((neighborBudget-${neighborSent[$node]:-0}))
+		fi
+		msgs=()
+		takeRecords $node $budget
+		((outQueueCount[$node]-=${#msgs[@]}))
+		((neighborSent[$node]+=${#msgs[@]}))
+		if [ ${#msgs[@]} -eq 0 ]; then
+			continue
+		fi
+		if neighborSupports $node batch; then
+			#The messages are packed into batches that fit into one bundle with their checksum (up to 12 bytes)
+			body=""
+			for msg in "${msgs[@]}"; do
+				if [ -n "$body" ] && (( ${#body}+1+${#msg}+12 > maxPayload )); then
+					sendBatch $node "$body"
+					body=""
+				fi
+				body+="${body:+;}$msg"
+			done
+			sendBatch $node "$body"
+		else
+			#Nodes without batch support (or not heard from yet) get one bundle per message
+			for msg in "${msgs[@]}"; do
+				sendPayload $node "$msg"
+			done
+		fi
+	done
+}
+
+#Link messages already processed, the origin timestamp makes every refresh unique
+declare -A seenMessages
+
+#Marks message $1 as seen, with a fixed capacity the oldest entry makes room for it
+#With the fixed capacity profile every new entry takes the next slot of a ring in insertion order,
+#and the entry that had the slot before is forgotten, so the table never holds more than maxSeenMessages entries
+declare -a seenRing
+seenRingPos=0
+markSeen() {
+	if [ "$fixedCapacity" == "true" ] && [ -z "${seenMessages[$1]}" ]; then
+		if [ -n "${seenRing[$seenRingPos]}" ]; then
+			unset seenMessages["${seenRing[$seenRingPos]}"]
+		fi
+		seenRing[$seenRingPos]=$1
+		seenRingPos=$(( (seenRingPos+1) % maxSeenMessages ))
+	fi
+	seenMessages[$1]=$SECONDS
+}
+
+expireSeenMessages() {
+	local key
+	for key in "${!seenMessages[@]}"; do
+		if (( SECONDS - ${seenMessages[$key]} > 10*updateInterval )); then
+			unset seenMessages["$key"]
+		fi
+	done
+}
+
+declare -A staticRefreshTime
+
+#Link database, "origin nodeA nodeB" -> expiry time (in SECONDS) and "timestamp hopcount origination" of the last message
+#The origination time (in SECONDS) is derived from the age of the message, so it does not depend on the origin clock
+declare -A linkDb
+declare -A linkInfo
+
+#Stores link $1 with expiry $2 and "timestamp hopcount origination" $3
+#With a fixed capacity a new link replaces the link that expires first, if that one expires earlier
+#A full link database replaces the link that expires first, taken from an index sorted by expiry time.
+#The index is only rebuilt when it is used up, entries of links that were refreshed or removed since are skipped.
+declare -a linkEvictIndex
+linkEvictPos=0
+storeLink() {
+	local key entry expiry
+	if [ "$fixedCapacity" == "true" ] && [ -z "${linkDb[$1]}" ] && (( ${#linkDb[@]} >= maxLinks )); then
+		while true; do
+			if (( linkEvictPos >= ${#linkEvictIndex[@]} )); then
+				mapfile -t linkEvictIndex < <(for key in "${!linkDb[@]}"; do
+						echo "${linkDb[$key]} $key"
+					done|sort -n)
+				linkEvictPos=0
+			fi
+			entry=${linkEvictIndex[$linkEvictPos]}
+			expiry=${entry%% *}
+			key=${entry#* }
+			if [ "${linkDb[$key]}" == "$expiry" ]; then
+				break
+			fi
+			((linkEvictPos++))
+		done
+		if (( expiry >= $2 )); then
+			((capacityDropCount++))
+			return
+		fi
+		((linkEvictPos++))
+		unset linkDb["$key"] linkInfo["$key"]
+	fi
+	linkDb[$1]=$2
+	linkInfo[$1]=$3
+}
+#Partition tracking, origins are lost when all of their links expired
+#originExpiry: live origin -> expiry of its last link (in SECONDS), lostOrigins: lost origin -> time (in SECONDS) it was lost
+declare -A originExpiry
+declare -A lostOrigins
+#Neighbors that need a link database synchronization (new neighbors or heals reached over them)
+declare -A healNeighbors
+
+expireLinks() {
+	local key end now
+	for key in "${!linkDb[@]}"; do
+		if (( ${linkDb[$key]} < SECONDS )); then
+			unset linkDb["$key"] linkInfo["$key"]
+		fi
+	done
+	now=$(date +%s)
+	for key in "${!scheduledContacts[@]}"; do
+		read -r end _ <<< "${scheduledContacts[$key]}"
+		if (( end < now )); then
+			unset scheduledContacts["$key"]
+		fi
+	done
+}
+
+#Scheduled contacts, "origin nodeA nodeB start" -> "end rate" (start and end in unix time)
+declare -A scheduledContacts
+
+storeSchedule() {
+	if [ "$fixedCapacity" == "true" ] && [ -z "${scheduledContacts[$1]}" ] && (( ${#scheduledContacts[@]} >= maxScheduledContacts )); then
+		((capacityDropCount++))
+		return
+	fi
+	scheduledContacts[$1]=$2
+}
+#Scheduled contacts installed into ION by this script, "nodeA nodeB start" -> "end rate"
+declare -A installedSchedules
+
+#Converts unix time to the ION time format
+ionTime() {
+	date -u -d @$1 +%Y/%m/%d-%H:%M:%S
+}
+
+detectPartitions() {
+	local origin
+	local -a lost
+	for origin in "${!originExpiry[@]}"; do
+		if (( ${originExpiry[$origin]} < SECONDS )); then
+			lostOrigins[$origin]=$SECONDS
+			unset originExpiry["$origin"]
+			lost+=($origin)
+		fi
+	done
+	if [ ${#lost[@]} -gt 0 ]; then
+		echo "$(tput setaf 1)Partition detected, origins no longer reachable:${lost[*]}$(tput setaf 7)"
+	fi
+}
+
+#Succeeds when origin $1 is tracked for partitions, with a fixed capacity at most maxNodes origins (live and lost) are tracked:
+#a new origin replaces the origin that was lost longest ago, and is not tracked when no origin is lost
+originTracked() {
+	local origin oldest=""
+	if [ "$fixedCapacity" != "true" ] || [ -n "${originExpiry[$1]}" ] || [ -n "${lostOrigins[$1]}" ] || (( ${#originExpiry[@]}+${#lostOrigins[@]} < maxNodes )); then
+		return 0
+	fi
+	for origin in "${!lostOrigins[@]}"; do
+		if [ -z "$oldest" ] || (( ${lostOrigins[$origin]} < ${lostOrigins[$oldest]} )); then
+			oldest=$origin
+		fi
+	done
+	if [ -z "$oldest" ]; then
+		((capacityDropCount++))
+		return 1
+	fi
+	unset lostOrigins["$oldest"]
+}
+
+#Prints the "origin:crc" digests of the link database, one line per origin in numerical order,
+#only of the origins from $1 to $2 when given
+originDigests() {
+	local key origin
+	local -A pairs
+	for key in "${!linkDb[@]}"; do
+		origin=${key%% *}
+		if (( origin < ${1:-0} )) || { [ -n "$2" ] && (( origin > $2 )); }; then
+			continue
+		fi
+		pairs[$origin]+="${key#* }"$'\n'
+	done
+	for origin in "${!pairs[@]}"; do
+		echo "$origin:$(msgChecksum "$(sort <<<"${pairs[$origin]}")")"
+	done|sort -n
+}
+
+#Digest messages, flag "q" asks the neighbor to reply with its own digests, "r" is the reply
+#The digests of the origins from $3 to $4 (all when not given) are split into messages that fit into one bundle,
+#every message ends with the first and last origin it covers (no last origin for the end of the range)
+queueDigest() {
+	local base="$msgidentifier 1 dg $nodeId $nodeId $2" first=${3:-0} list="" digest origin
+	while read -r digest; do
+		origin=${digest%%:*}
+		#Fields of a message ending before this origin, with the longest checksum
+		if [ -n "$list" ] && (( ${#base}+${#list}+${#digest}+${#first}+${#origin}+${#4}+4+12 > maxPayload )); then
+			queueMessage $1 "$base ${list#,} $first $((origin-1))"
+			first=$origin
+			list=""
+		fi
+		list+=",$digest"
+	done < <(originDigests $3 $4)
+	list=${list#,}
+	digest="$base ${list:--} $first $4"
+	queueMessage $1 "${digest% }"
+}
+
+#Sends neighbor $1 our links of every origin whose digest differs from the received digests $3 (flag $2)
+#The digests cover the origins from $4 to $5, all origins without $4, and no upper limit without $5
+syncWithDigests() {
+	local entry key origin ts hop orig differs=0
+	local -a entries
+	local -A theirs ours
+	IFS=',' read -ra entries <<< "$3"
+	for entry in "${entries[@]}"; do
+		if [ "$entry" != "-" ]; then
+			theirs[${entry%%:*}]=${entry#*:}
+		fi
+	done
+	while read -r entry; do
+		ours[${entry%%:*}]=${entry#*:}
+	done < <(originDigests $4 $5)
+	for key in "${!linkDb[@]}"; do
+		origin=${key%% *}
+		if [ -n "${ours[$origin]}" ] && [ "$origin" != "$1" ] && [ "${theirs[$origin]}" != "${ours[$origin]}" ]; then
+			read -r ts hop orig <<< "${linkInfo[$key]}"
+			queueMessage $1 "$msgidentifier 1 li $origin $nodeId ${key#* } $ts $((hop+1)) $((${linkDb[$key]}-orig)) $((SECONDS-orig))"
+		fi
+	done
+	for origin in "${!theirs[@]}"; do
+		if [ "${theirs[$origin]}" != "${ours[$origin]}" ]; then
+			differs=1
+		fi
+	done
+	#The reply covers the same origins
+	if [ "$2" == "q" ] && [ $differs -eq 1 ]; then
+		queueDigest $1 r $4 $5
+	fi
+}
+
+#Hop distance from the local node and the previous node on the shortest path, for every node reachable over the link database
+declare -A nodeDepth
+declare -A nodeParent
+
+computeReachable() {
+	local key a b end node next now
+	local -a queue
+	local -A adjacency
+	for key in "${!linkDb[@]}"; do
+		read -r _ a b <<< "$key"
+		adjacency[$a]+=" $b"
+		adjacency[$b]+=" $a"
+	done
+	#Scheduled contacts that have not ended connect their nodes too, CGR can plan through a future pass
+	now=$(date +%s)
+	for key in "${!scheduledContacts[@]}"; do
+		read -r _ a b _ <<< "$key"
+		read -r end _ <<< "${scheduledContacts[$key]}"
+		if (( end > now )); then
+			adjacency[$a]+=" $b"
+			adjacency[$b]+=" $a"
+		fi
+	done
+	nodeDepth=([$nodeId]=0)
+	nodeParent=()
+	queue=($nodeId)
+	while [ ${#queue[@]} -gt 0 ]; do
+		node=${queue[0]}
+		queue=("${queue[@]:1}")
+		for next in ${adjacency[$node]}; do
+			if [ -z "${nodeDepth[$next]}" ]; then
+				nodeDepth[$next]=$((${nodeDepth[$node]}+1))
+				nodeParent[$next]=$node
+				queue+=($next)
+			fi
+		done
+	done
+}
+
+#Flap damping, "nodeA nodeB" (lower node first) -> penalty and time (in SECONDS) when the penalty was last increased
+declare -A linkPenalty
+declare -A linkPenaltyTime
+#Links present in the link database in the last loop, and suppressed links -> time of their last advertisement
+declare -A linkUp
+declare -A suppressedLinks
+flapCount=0
+
+#Sets penalty to the current (decayed) penalty of link $1
+currentPenalty() {
+	local dt=$((SECONDS-${linkPenaltyTime[$1]:-$SECONDS}))
+	penalty=${linkPenalty[$1]:-0}
+	if (( dt >= 32*flapHalfLife )); then
+		penalty=0
+		return
+	fi
+	penalty=$(( penalty >> (dt/flapHalfLife) ))
+	#Linear approximation within one half-life
+	penalty=$(( penalty - penalty*(dt%flapHalfLife)/(2*flapHalfLife) ))
+}
+
+#Penalizes the links that went down since the last loop and updates their suppression state
+dampFlaps() {
+	local key a b pair
+	local -A present
+	for key in "${!linkDb[@]}"; do
+		read -r _ a b <<< "$key"
+		if (( a > b )); then
+			present["$b $a"]=1
+		else
+			present["$a $b"]=1
+		fi
+	done
+	for pair in "${!linkUp[@]}"; do
+		if [ -z "${present[$pair]}" ]; then
+			if [ "$fixedCapacity" == "true" ] && [ -z "${linkPenalty[$pair]}" ] && (( ${#linkPenalty[@]} >= maxFlapPairs )); then
+				((capacityDropCount++))
+				continue
+			fi
+			currentPenalty "$pair"
+			penalty=$((penalty+flapPenalty))
+			if (( penalty > flapMaxPenalty )); then
+				penalty=$flapMaxPenalty
+			fi
+			linkPenalty[$pair]=$penalty
+			linkPenaltyTime[$pair]=$SECONDS
+			((flapCount++))
+			if [ -z "${suppressedLinks[$pair]}" ] && (( penalty > flapSuppressLimit )); then
+				echo "$(tput setaf 1)Link $pair is flapping, suppressed[Penalty:$penalty]$(tput setaf 7)"
+				suppressedLinks[$pair]=$SECONDS
+			fi
+		fi
+	done
+	linkUp=()
+	for pair in "${!present[@]}"; do
+		linkUp[$pair]=1
+	done
+	#A suppressed link is used again only when its penalty decayed below the (lower) reuse limit
+	for pair in "${!linkPenalty[@]}"; do
+		currentPenalty "$pair"
+		if [ -n "${suppressedLinks[$pair]}" ]; then
+			if (( penalty < flapReuseLimit )); then
+				echo "$(tput setaf 2)Link $pair is stable again, suppression removed[Penalty:$penalty]$(tput setaf 7)"
+				unset suppressedLinks["$pair"]
+			fi
+		elif (( penalty < flapReuseLimit/2 )); then
+			unset linkPenalty["$pair"] linkPenaltyTime["$pair"]
+		fi
+	done
+}
+
+#Returns true when the link between nodes $1 and $2 may be advertised now, suppressed links only every flapSuppressedInterval seconds
+linkAdvertised() {
+	local pair="$1 $2"
+	if (( $1 > $2 )); then
+		pair="$2 $1"
+	fi
+	if [ -z "${suppressedLinks[$pair]}" ]; then
+		return 0
+	fi
+	if (( flapSuppressedInterval > 0 && SECONDS - ${suppressedLinks[$pair]} >= flapSuppressedInterval )); then
+		suppressedLinks[$pair]=$SECONDS
+		return 0
+	fi
+	return 1
+}
+
+#Links installed into ION by this script, "nodeA nodeB" (lower node first) -> install time (in SECONDS)
+declare -A installedLinks
+
+#Sets impact to the ION apply order of a change ($3 is add, del or refresh) of the link between nodes $1 and $2:
+#0 withdrawals of local links, 1 other local changes, 2 changes within priorityHops hops, 3 distant changes, 4 refreshes
+impactClass() {
+	local depth=${nodeDepth[$1]:-$((priorityHops+1))}
+	if [ "$3" == "refresh" ]; then
+		impact=4
+	elif [ "$1" == "$nodeId" ] || [ "$2" == "$nodeId" ]; then
+		if [ "$3" == "del" ]; then
+			impact=0
+		else
+			impact=1
+		fi
+	else
+		if (( ${nodeDepth[$2]:-depth} < depth )); then
+			depth=${nodeDepth[$2]}
+		fi
+		if (( depth <= priorityHops )); then
+			impact=2
+		else
+			impact=3
+		fi
+	fi
+}
+
+#Sets start to the first time from $3 on (unix time) at which no scheduled or operator contact between nodes $1 and $2 starts,
+#ION tells the contacts of a node pair apart by their start time only
+freeStart() {
+	local key window x y t
+	local -A taken
+	for key in "${!scheduledContacts[@]}"; do
+		read -r _ x y t <<< "$key"
+		if [[ "$x $y" == "$1 $2" || "$x $y" == "$2 $1" ]]; then
+			taken[$t]=1
+		fi
+	done
+	for window in ${operatorPairs[$1 $2]} ${operatorPairs[$2 $1]}; do
+		taken[${window%:*}]=1
+	done
+	start=$3
+	while [ -n "${taken[$start]}" ]; do
+		((start++))
+	done
+}
+
+#Adds the deletion of the learned contact between nodes $1 and $2 (lower node first) to the commands of updateContactPlan,
+#ION removes a window that is over by itself
+deleteLearned() {
+	local start=${learnedStarts[$1 $2]}
+	if [ -n "$start" ] && (( ${learnedEnds[$1 $2]} > now )); then
+		commands+=("$impact d contact $start $1 $2" "$impact d contact $start $2 $1" "$impact d range $start $1 $2" "$impact d range $start $2 $1")
+	fi
+}
+
+#Brings the ION contact plan in line with the link database, only the differences are applied
+#The ION commands are prefixed with their impact class and applied in that order
+updateContactPlan() {
+	local key a b pair node start end rate now window
+	local -a commands
+	local -A desired desiredSchedules
+	computeReachable
+	now=$(date +%s)
+	mergedLinks=()
+	for key in "${!linkDb[@]}"; do
+		read -r _ a b <<< "$key"
+		if (( a > b )); then
+			pair="$b $a"
+		else
+			pair="$a $b"
+		fi
+		if [ -n "${suppressedLinks[$pair]}" ]; then
+			continue
+		fi
+		if [ "$pruneUnreachable" != "true" ] || [ -n "${nodeDepth[$a]}" ]; then
+			if (( installHopLimit == 0 )) || [[ -n "${nodeDepth[$a]}" && ${nodeDepth[$a]} -le $installHopLimit && ${nodeDepth[$b]} -le $installHopLimit ]]; then
+				desired[$pair]=1
+			fi
+		fi
+	done
+	if (( installHopLimit > 0 )); then
+		for node in "${!nodeDepth[@]}"; do
+			if (( ${nodeDepth[$node]} > installHopLimit )); then
+				a=$node
+				while (( ${nodeDepth[$a]} > installHopLimit )); do
+					a=${nodeParent[$a]}
+				done
+				if (( a > node )); then
+					desired["$node $a"]=1
+				else
+					desired["$a $node"]=1
+				fi
+			fi
+		done
+	fi
+	for pair in "${!desired[@]}"; do
+		#Learned links are merged into an operator contact of the same node pair that is on now, which stays as configured
+		if [ -n "${operatorPairs[$pair]}" ] && operatorCovers $pair $now $((now+1)); then
+			mergedLinks[$pair]=1
+			continue
+		fi
+		#Contacts are installed again before ION expires them, and when their window ended at an operator contact
+		if [ -z "${installedLinks[$pair]}" ] || (( SECONDS - ${installedLinks[$pair]} > contactDuration/2 || ${learnedEnds[$pair]:-0} <= now )); then
+			read -r a b <<< "$pair"
+			freeStart $a $b $((now+1))
+			#Next to operator contacts the learned window ends where the next operator window starts
+			end=$((now+contactDuration))
+			for window in ${operatorPairs[$pair]}; do
+				if (( ${window%:*} > now && ${window%:*} < end )); then
+					end=${window%:*}
+				fi
+			done
+			if (( end <= start )); then
+				continue
+			fi
+			if [ -z "${installedLinks[$pair]}" ]; then
+				topologyChanges+=("add link $a $b")
+				impactClass $a $b add
+			else
+				impactClass $a $b refresh
+			fi
+			#Learned contacts get absolute times, so they are deleted by their start time without touching scheduled,
+			#operator or hand-configured contacts of the same node pair. A refresh replaces the previous window.
+			deleteLearned $a $b
+			learnedEnds[$pair]=$end
+			start=$(ionTime $start)
+			end=$(ionTime $end)
+			commands+=("$impact a contact $start $end $a $b 100000" "$impact a contact $start $end $b $a 100000")
+			commands+=("$impact a range $start $end $a $b 1" "$impact a range $start $end $b $a 1")
+			learnedStarts[$pair]=$start
+			installedLinks[$pair]=$SECONDS
+		fi
+	done
+	for pair in "${!installedLinks[@]}"; do
+		if [ -z "${desired[$pair]}" ]; then
+			read -r a b <<< "$pair"
+			impactClass $a $b del
+			deleteLearned $a $b
+			topologyChanges+=("del link $a $b")
+			unset installedLinks["$pair"] learnedStarts["$pair"] learnedEnds["$pair"]
+		fi
+	done
+	#Scheduled contacts are installed when one of their nodes is reachable
+	for key in "${!scheduledContacts[@]}"; do
+		read -r _ a b start <<< "$key"
+		read -r end _ <<< "${scheduledContacts[$key]}"
+		if operatorCovers $a $b $start $end; then
+			mergedLinks["$a $b $start"]=1
+			continue
+		fi
+		if [ "$pruneUnreachable" != "true" ] || [ -n "${nodeDepth[$a]}" ] || [ -n "${nodeDepth[$b]}" ]; then
+			desiredSchedules["$a $b $start"]=${scheduledContacts[$key]}
+		fi
+	done
+	for key in "${!installedSchedules[@]}"; do
+		if [ "${installedSchedules[$key]}" != "${desiredSchedules[$key]}" ]; then
+			read -r a b start <<< "$key"
+			read -r end _ <<< "${installedSchedules[$key]}"
+			#ION removes contacts that are over by itself
+			if (( end > now )); then
+				impactClass $a $b del
+				commands+=("$impact d contact $(ionTime $start) $a $b" "$impact d contact $(ionTime $start) $b $a")
+				commands+=("$impact d range $(ionTime $start) $a $b" "$impact d range $(ionTime $start) $b $a")
+			fi
+			topologyChanges+=("del contact $a $b $start")
+			unset installedSchedules["$key"]
+		fi
+	done
+	for key in "${!desiredSchedules[@]}"; do
+		if [ -z "${installedSchedules[$key]}" ]; then
+			read -r a b start <<< "$key"
+			read -r end rate <<< "${desiredSchedules[$key]}"
+			impactClass $a $b add
+			commands+=("$impact a contact $(ionTime $start) $(ionTime $end) $a $b $rate" "$impact a contact $(ionTime $start) $(ionTime $end) $b $a $rate")
+			commands+=("$impact a range $(ionTime $start) $(ionTime $end) $a $b 1" "$impact a range $(ionTime $start) $(ionTime $end) $b $a 1")
+			topologyChanges+=("add contact $a $b $start $end")
+			installedSchedules[$key]=${desiredSchedules[$key]}
+		fi
+	done
+	echo "Reachable nodes:${#nodeDepth[@]}, installed links:${#installedLinks[@]}, scheduled contacts:${#installedSchedules[@]}, merged into operator contacts:${#mergedLinks[@]}, ION commands:${#commands[@]}"
+	if [ ${#commands[@]} -gt 0 ]; then
+		for key in "${commands[@]}"; do
+			read -r _ a b _ <<< "$key"
+			((ionCommandCount["$a $b"]++))
+		done
+		#A stable sort keeps the order of the commands within one class
+		ionCall contact_update ionadmin < <(printf '%s\n' "${commands[@]}"|sort -s -n -k1,1|cut -d' ' -f2-)
+	fi
+}
+
+#Forwards the received message in cmdarray to all neighbors, except to the origin and the sender
+#Neighbors that do not support feature $1 (when given) are skipped
+forwardMessage() {
+	local out
+	local -a fwdarray
+	#The received payload is reused as is, only the sender and the hopcount fields are patched.
+	#The same forward message is shared by all neighbors.
+	fwdarray=("${cmdarray[@]}")
+	fwdarray[4]=$nodeId
+	if [[ "${fwdarray[8]}" =~ ^[0-9]+$ ]]; then
+		fwdarray[8]=$((fwdarray[8]+1))
+	fi
+	for out in "${plans[@]}"; do
+		if [ "$msgOrigin" != "$out" ] && [ "$msgSentFrom" != "$out" ] && [ "$nodeId" != "$out" ] && segmentForwardAllowed $out; then
+			echo "$(tput setaf 5)Forwarding ${cmdarray[2]} message[Origin:$msgOrigin,From:$msgSentFrom,To:$out]$(tput setaf 7)"
+			queueMessage $out "${fwdarray[*]}" $1
+		fi
+	done
+}
+
+#Reads the records published by local processes and originates them as our own messages:
+#  li <nodeA> <nodeB> [timespan]            link between two nodes, valid for timespan seconds
+#  ct <start> <end> <nodeA> <nodeB> [rate]  scheduled contact window, start and end in unix time
+#  compact                                  compacts the ION contact plan after the next update
+#A line that is only partly written when the pipe is read is kept in publishPartial until the rest arrives
+publishPartial=""
+processPublished() {
+	local ts accepted=0 received=0 msg plan chunk
+	local -a rec
+	ts=$(date +%s)
+	while read -r -t 0.01 -u 5 chunk || { publishPartial+=$chunk; false; }; do
+		read -r -a rec <<< "$publishPartial$chunk"
+		publishPartial=""
+		((received++))
+		if [ ${#rec[@]} -eq 0 ]; then
+			continue
+		fi
+		if (( accepted >= publishMaxRecords )); then
+			((publishDroppedCount++))
+			continue
+		fi
+		if [[ "${rec[0]}" == "compact" && ${#rec[@]} -eq 1 ]]; then
+			compactRequested=1
+			continue
+		fi
+		msg=""
+		if [[ "${rec[0]}" == "li" && "${rec[1]}" =~ ^[0-9]+$ && "${rec[2]}" =~ ^[0-9]+$ && "${rec[3]:-$linkLifetime}" =~ ^[0-9]+$ && ${#rec[@]} -le 4 ]]; then
+			msg="$msgidentifier 1 li $nodeId $nodeId ${rec[1]} ${rec[2]} 0 0 ${rec[3]:-$linkLifetime} 0"
+			storeLink "$nodeId ${rec[1]} ${rec[2]}" $((SECONDS+${rec[3]:-$linkLifetime})) "0 0 $SECONDS"
+		elif [[ "${rec[0]}" == "ct" && "${rec[1]}" =~ ^[0-9]+$ && "${rec[2]}" =~ ^[0-9]+$ && "${rec[3]}" =~ ^[0-9]+$ && "${rec[4]}" =~ ^[0-9]+$ && "${rec[5]:-100000}" =~ ^[0-9]+$ && ${#rec[@]} -le 6 ]] && (( rec[2] > rec[1] )); then
+			msg="$msgidentifier 1 ct $nodeId $nodeId ${rec[3]} ${rec[4]} $ts 0 ${rec[1]} ${rec[2]} ${rec[5]:-100000}"
+			storeSchedule "$nodeId ${rec[3]} ${rec[4]} ${rec[1]}" "${rec[2]} ${rec[5]:-100000}"
+		fi
+		if [ -z "$msg" ]; then
+			echo "$(tput setaf 1)Invalid published record rejected:${rec[*]}$(tput setaf 7)"
+			((publishRejectedCount++))
+			continue
+		fi
+		((accepted++))
+		for plan in "${plans[@]}"; do
+			if [ "$plan" != "$nodeId" ]; then
+				if [ "${rec[0]}" == "ct" ]; then
+					queueMessage $plan "$msg" ct
+				else
+					queueMessage $plan "$msg"
+				fi
+			fi
+		done
+	done
+	if (( received == 0 )); then
+		return
+	fi
+	((publishedCount+=accepted))
+	echo "Published records accepted:$accepted"
+}
+
+#Contacts and ranges in the ION contact plan, one "contact|range start end nodeA nodeB rate|owlt" line per entry
+listContactPlan() {
+	ionCall contact_list ionadmin <<<$'l contact\nl range'
+	awk '{i=index($0, "From "); if (!i) next; $0=substr($0, i)
+		if ($0 ~ /xmit rate/) kind="contact"; else if ($0 ~ /OWLT/) kind="range"; else next
+		n=0; for (i=1; i<NF; i++) { if ($i == "node") node[++n]=$(i+1); if ($i == "is") value=$(i+1) }
+		print kind, $2, $4, node[1], node[2], value}' <<<"$ionReply"
+}
+
+#Operator contacts and ranges, "nodeA nodeB" (lower node first) -> " start:end ..." windows (unix time)
+#and the imported entries ("contact|range start end nodeA nodeB rate|owlt", unix time)
+declare -A operatorPairs
+declare -a operatorEntries
+declare -A mergedLinks
+#Start time (ION format) and end time (unix time) of the learned contact installed for every node pair in installedLinks
+declare -A learnedStarts
+declare -A learnedEnds
+
+#Converts an ION time ("+seconds" from now or yyyy/mm/dd-hh:mm:ss) to unix time
+unixTime() {
+	if [[ "$1" == +* ]]; then
+		echo $(( $(date +%s)+${1#+} ))
+	else
+		date -u -d "${1/-/ }" +%s 2>/dev/null
+	fi
+}
+
+#Reads the operator contacts and ranges from the ionrc file (operatorContacts)
+#The running ION contact plan is not imported, after a restart it also holds the contacts dtnex installed before
+importOperatorContacts() {
+	local kind start end a b value pair
+	while read -r kind start end a b value; do
+		start=$(unixTime $start)
+		end=$(unixTime $end)
+		if ! [[ "$start" =~ ^[0-9]+$ && "$end" =~ ^[0-9]+$ && "$a" =~ ^[0-9]+$ && "$b" =~ ^[0-9]+$ && "$value" =~ ^[0-9.]+$ ]] || [ "$a" == "$b" ]; then
+			continue
+		fi
+		operatorEntries+=("$kind $start $end $a $b $value")
+		if [ "$kind" == "contact" ]; then
+			pair="$a $b"
+			if (( a > b )); then
+				pair="$b $a"
+			fi
+			operatorPairs[$pair]+=" $start:$end"
+		fi
+	done < <(awk '$1 == "a" && ($2 == "contact" || $2 == "range") {print $2, $3, $4, $5, $6, $7}' "$operatorContacts")
+	echo "Operator contacts imported:${#operatorEntries[@]} entries, ${#operatorPairs[@]} node pairs"
+}
+
+#Succeeds when the operator has a contact between nodes $1 and $2 overlapping the time from $3 to $4 (unix time)
+operatorCovers() {
+	local pair="$1 $2" window
+	if (( $1 > $2 )); then
+		pair="$2 $1"
+	fi
+	for window in ${operatorPairs[$pair]}; do
+		if (( ${window%:*} < $4 && ${window#*:} > $3 )); then
+			return 0
+		fi
+	done
+	return 1
+}
+
+#Average time (in ms) of the route computation to up to 10 known nodes, "-" without cgrfetch
+cgrTiming() {
+	local node start count=0
+	if ! command -v cgrfetch >/dev/null; then
+		echo "-"
+		return
+	fi
+	start=${EPOCHREALTIME/[.,]/}
+	for node in "${!nodeDepth[@]}"; do
+		if [ "$node" != "$nodeId" ] && (( count < 10 )); then
+			cgrfetch $node>/dev/null 2>&1
+			((count++))
+		fi
+	done
+	echo $(( (${EPOCHREALTIME/[.,]/}-start)/1000/(count ? count : 1) ))
+}
+
+#Compacts the ION contact plan: self-loops and entries not backed by the link database are removed,
+#several entries of one installed link are merged into one. All changes are applied in one ionadmin call.
+#Kept are the links installed by this script, the installed scheduled contacts, operator contacts, links of the local node and its loopback.
+compactRequested=0
+compactContactPlan() {
+	local kind start end a b pair key removed=0 merged=0 startTime cgrBefore cgrAfter
+	local contactsBefore=0 rangesBefore=0 contactsAfter=0 rangesAfter=0
+	local -a commands
+	local -A scheduleStarts
+	startTime=${EPOCHREALTIME/[.,]/}
+	for key in "${!installedSchedules[@]}"; do
+		read -r a b start <<< "$key"
+		start=$(ionTime $start)
+		scheduleStarts["$a $b $start"]=1
+		scheduleStarts["$b $a $start"]=1
+	done
+	cgrBefore=$(cgrTiming)
+	while read -r kind start end a b _; do
+		if [ "$kind" == "contact" ]; then
+			((contactsBefore++))
+		else
+			((rangesBefore++))
+		fi
+		pair="$a $b"
+		if (( a > b )); then
+			pair="$b $a"
+		fi
+		if [ "$a" == "$b" ] && [ "$a" == "$nodeId" ]; then
+			continue
+		elif [ -n "${operatorPairs[$pair]}" ]; then
+			continue
+		elif [ -n "${scheduleStarts["$a $b $start"]}" ]; then
+			#Scheduled contacts of an installed link are not duplicates of it
+			continue
+		elif [ "$a" != "$b" ] && [ -n "${installedLinks[$pair]}" ]; then
+			#Other entries of an installed link are merged into the window dtnex installed last
+			if [ "$start" != "${learnedStarts[$pair]}" ]; then
+				commands+=("d $kind $start $a $b")
+				((merged++))
+			fi
+		elif [ "$a" != "$b" ] && [[ "$a" == "$nodeId" && " ${plans[*]} " == *" $b "* || "$b" == "$nodeId" && " ${plans[*]} " == *" $a "* ]]; then
+			continue
+		else
+			commands+=("d $kind $start $a $b")
+			((removed++))
+		fi
+	done < <(listContactPlan)
+	if [ ${#commands[@]} -gt 0 ]; then
+		ionCall compact ionadmin < <(printf '%s\n' "${commands[@]}")
+	fi
+	while read -r kind _; do
+		if [ "$kind" == "contact" ]; then
+			((contactsAfter++))
+		else
+			((rangesAfter++))
+		fi
+	done < <(listContactPlan)
+	cgrAfter=$(cgrTiming)
+	echo "$(tput setaf 2)Contact plan compacted in $(( (${EPOCHREALTIME/[.,]/}-startTime)/1000 ))ms: contacts $contactsBefore -> $contactsAfter, ranges $rangesBefore -> $rangesAfter, removed:$removed, merged:$merged, route computation ${cgrBefore}ms -> ${cgrAfter}ms$(tput setaf 7)"
+	echo "$(date +%s) contacts:$contactsBefore->$contactsAfter ranges:$rangesBefore->$rangesAfter removed:$removed merged:$merged cgr_ms:$cgrBefore->$cgrAfter">>$compactReport
+	compactRequested=0
+}
+
+#Snapshot files are written to a temporary file and renamed over the previous version, so readers take no lock and
+#always see one complete version; a reader that still has the old file open keeps reading the old version.
+#Every new version gets the next epoch number, unchanged tables are not rewritten.
+snapshotEpoch=0
+declare -A snapshotContent
+
+publishSnapshot() {
+	if [ "${snapshotContent[$1]-x}" == "$2" ]; then
+		return
+	fi
+	snapshotContent[$1]=$2
+	((snapshotEpoch++))
+	{
+		echo "#dtnex $1 epoch $snapshotEpoch time $(date +%s)"
+		if [ -n "$2" ]; then
+			echo "$2"
+		fi
+		echo "#end epoch $snapshotEpoch"
+	}>$snapshotDir/.$1.tmp
+	mv -f $snapshotDir/.$1.tmp $snapshotDir/$1
+}
+
+publishSnapshots() {
+	local node pair key now neighbors contacts policy kind start end a b value
+	if [ -z "$snapshotDir" ]; then
+		return
+	fi
+	now=$(date +%s)
+	#neighbors: node features priority last-hello (unix time)
+	neighbors=$(for node in "${plans[@]}"; do
+		if [ "$node" != "$nodeId" ]; then
+			echo "$node ${neighborFeatures[$node]:--} ${neighborPriority[$node]:--} $(( ${neighborHelloTime[$node]:+now-SECONDS+${neighborHelloTime[$node]}}+0 ))"
+		fi
+	done|sort -n)
+	#contacts: installed links and scheduled contacts
+	contacts=$({
+		for pair in "${!installedLinks[@]}"; do
+			echo "link $pair"
+		done
+		for key in "${!installedSchedules[@]}"; do
+			echo "contact $key ${installedSchedules[$key]}"
+		done
+		for key in "${operatorEntries[@]}"; do
+			read -r kind start end a b value <<< "$key"
+			if [ "$kind" == "contact" ]; then
+				echo "operator $a $b $start $end $value"
+			fi
+		done
+	}|sort -k1,1 -k2n -k3n)
+	#policy: settings of the contact plan and the flooding, suppressed links
+	policy=$({
+		echo "pruneUnreachable $pruneUnreachable"
+		echo "installHopLimit $installHopLimit"
+		echo "flapDamping $flapDamping"
+		echo "designatedFlooder ${floodDR:--}"
+		echo "backupFlooder ${floodBDR:--}"
+		for pair in "${!suppressedLinks[@]}"; do
+			echo "suppressed $pair"
+		done|sort -k2n -k3n
+	})
+	publishSnapshot neighbors "$neighbors"
+	publishSnapshot contacts "$contacts"
+	publishSnapshot policy "$policy"
+}
+
+#Node positions, node -> "timestamp lat lon alt speed track climb"
+declare -A nodePosition
+
+#Reads the own position into ownPosition ("lat lon alt speed track climb"), empty when no position is available
+readPosition() {
+	local tpv field
+	local -a fields
+	ownPosition=""
+	if [ "$positionSource" == "gpsd" ]; then
+		tpv=$(timeout 5 gpspipe -w -n 10 2>/dev/null|grep -m1 '"class":"TPV".*"lat"')
+		if [ -z "$tpv" ]; then
+			return
+		fi
+		for field in lat lon 'alt(HAE|MSL)?' speed track climb; do
+			if [[ "$tpv" =~ \"$field\":(-?[0-9]+(\.[0-9]+)?) ]]; then
+				ownPosition+=" ${BASH_REMATCH[-2]}"
+			else
+				ownPosition+=" 0"
+			fi
+		done
+		ownPosition=${ownPosition# }
+	elif [ -f "$positionSource" ]; then
+		read -r -a fields < "$positionSource"
+		for field in "${fields[@]:0:6}"; do
+			if ! [[ "$field" =~ ^-?[0-9]+(\.[0-9]+)?$ ]]; then
+				echo "$(tput setaf 1)Invalid position in $positionSource$(tput setaf 7)"
+				return
+			fi
+		done
+		if [ ${#fields[@]} -ge 2 ]; then
+			fields+=(0 0 0 0)
+			ownPosition="${fields[*]:0:6}"
+		fi
+	fi
+}
+
+#Predicts the contact windows of all node pairs from their positions and stores them as scheduled contacts of origin "predicted"
+#Positions are extrapolated along their velocity, on a flat earth around the two nodes, which is good enough for radio ranges
+predictContacts() {
+	local node ts a b start end key match oldStart oldEnd now
+	local -A predicted
+	now=$(date +%s)
+	for node in "${!nodePosition[@]}"; do
+		read -r ts _ <<< "${nodePosition[$node]}"
+		if (( ts < now-positionLifetime )); then
+			unset nodePosition["$node"]
+		fi
+	done
+	while read -r a b start end; do
+		#An ongoing prediction is kept while its end moves less than a quarter of the horizon, so ION is not updated every loop
+		match=""
+		for key in "${!scheduledContacts[@]}"; do
+			if [[ "$key" == "predicted $a $b "* ]]; then
+				read -r oldEnd _ <<< "${scheduledContacts[$key]}"
+				if (( ${key##* } <= end && start <= oldEnd )); then
+					match=$key
+				fi
+			fi
+		done
+		if [ -n "$match" ]; then
+			oldStart=${match##* }
+			read -r oldEnd _ <<< "${scheduledContacts[$match]}"
+			if (( end-oldEnd < predictionHorizon/4 && oldEnd-end < predictionHorizon/4 )); then
+				predicted[$match]=1
+				continue
+			fi
+			if (( oldStart <= now )); then
+				start=$oldStart
+			fi
+			unset scheduledContacts["$match"]
+		fi
+		key="predicted $a $b $start"
+		storeSchedule "$key" "$end $predictedRate"
+		predicted[$key]=1
+	done < <(for node in "${!nodePosition[@]}"; do
+			echo "$node ${nodePosition[$node]}"
+		done|awk -v now=$now -v horizon=$predictionHorizon -v step=$predictionStep -v range=$linkRange -v ranges="$linkRanges" '
+		BEGIN {
+			rad=3.14159265/180
+			n=split(ranges, r, " ")
+			for (i=1; i<=n; i++) {
+				split(r[i], kv, ":")
+				split(kv[1], ab, "-")
+				linkRange[ab[1] " " ab[2]]=kv[2]
+				linkRange[ab[2] " " ab[1]]=kv[2]
+			}
+		}
+		{
+			node[NR]=$1; t0[NR]=$2; lat[NR]=$3; lon[NR]=$4; alt[NR]=$5
+			vx[NR]=$6*sin($7*rad); vy[NR]=$6*cos($7*rad); vz[NR]=$8
+		}
+		END {
+			for (i=1; i<=NR; i++) for (j=i+1; j<=NR; j++) {
+				a=node[i]; b=node[j]
+				if (a+0 > b+0) { a=node[j]; b=node[i] }
+				maxRange=(a " " b in linkRange) ? linkRange[a " " b] : range
+				coslat=cos((lat[i]+lat[j])/2*rad)
+				start=-1
+				for (t=now-now%step; t<=now+horizon; t+=step) {
+					x=(lon[j]-lon[i])*111195*coslat + vx[j]*(t-t0[j]) - vx[i]*(t-t0[i])
+					y=(lat[j]-lat[i])*111195 + vy[j]*(t-t0[j]) - vy[i]*(t-t0[i])
+					z=alt[j]-alt[i] + vz[j]*(t-t0[j]) - vz[i]*(t-t0[i])
+					inRange=(x*x+y*y+z*z <= maxRange*maxRange)
+					if (inRange && start < 0) start=t
+					if (!inRange && start >= 0) { print a, b, start, t; start=-1 }
+				}
+				if (start >= 0) print a, b, start, t-step
+			}
+		}')
+	for key in "${!scheduledContacts[@]}"; do
+		if [[ "$key" == "predicted "* ]] && [ -z "${predicted[$key]}" ]; then
+			unset scheduledContacts["$key"]
+		fi
+	done
+}
+
+#Topology changes of the current loop, queued changes and state of every hook
+declare -a topologyChanges
+declare -A hookQueue
+declare -A hookLastRun
+declare -A hookPid
+hookDroppedCount=0
+
+#Hands the coalesced topology changes to the hooks in the background, a slow hook never blocks the loop
+runHooks() {
+	local hook batch
+	if [ ! -d "$hookDir" ]; then
+		topologyChanges=()
+		return
+	fi
+	for hook in "$hookDir"/*; do
+		if [ -d "$hook" ] || ! [[ -x "$hook" || -p "$hook" ]]; then
+			continue
+		fi
+		if [ ${#topologyChanges[@]} -gt 0 ]; then
+			hookQueue[$hook]+=$(printf '%s\n' "${topologyChanges[@]}")$'\n'
+		fi
+		if [ -z "${hookQueue[$hook]}" ]; then
+			continue
+		fi
+		batch=$(wc -l <<<"${hookQueue[$hook]%$'\n'}")
+		if (( batch > hookQueueMax )); then
+			((hookDroppedCount+=batch-hookQueueMax))
+			hookQueue[$hook]=$(tail -n $hookQueueMax <<<"${hookQueue[$hook]%$'\n'}")$'\n'
+		fi
+		#The previous call must be finished and hookMinInterval passed
+		if [ -n "${hookPid[$hook]}" ] && kill -0 ${hookPid[$hook]} 2>/dev/null; then
+			continue
+		fi
+		if [ -n "${hookLastRun[$hook]}" ] && (( SECONDS - ${hookLastRun[$hook]} < hookMinInterval )); then
+			continue
+		fi
+		batch=${hookQueue[$hook]}
+		if [ -p "$hook" ]; then
+			#The pipe is opened inside the timed process, the open blocks until a reader is there
+			(timeout $hookMinInterval sh -c 'cat >"$1"' _ "$hook" <<<"${batch%$'\n'}") &
+		else
+			("$hook" <<<"${batch%$'\n'}" >/dev/null 2>&1) &
+		fi
+		hookPid[$hook]=$!
+		hookLastRun[$hook]=$SECONDS
+		hookQueue[$hook]=""
+	done
+	topologyChanges=()
+}
+
+#Node information of other nodes, origin -> attributes and version
+declare -A nodeAttrs
+declare -A nodeAttrVersion
+
+#Node information values may only contain characters that are safe inside a message field
+attrValue() {
+	local value=${1//,//}
+	echo "${value//[^A-Za-z0-9._:\/+-]/_}"
+}
+
+#Queues our own node information and the cached information of all other nodes for neighbor $1
+queueNodeInfo() {
+	local origin
+	queueMessage $1 "$msgidentifier 1 na $nodeId $nodeId $ownAttrVersion $ownAttrs $(date +%s) 0" na
+	for origin in "${!nodeAttrs[@]}"; do
+		if [ "$origin" != "$1" ]; then
+			queueMessage $1 "$msgidentifier 1 na $origin $nodeId ${nodeAttrVersion[$origin]} ${nodeAttrs[$origin]} 0 1" na
+		fi
+	done
+}
+
+#Authoritative schedule, installed version and the records since the last full schedule (sent to new neighbors)
+#Records are kept as "version base timestamp kind signature entries", entries are "+nodeA:nodeB:start:end:rate" (add)
+#and "-nodeA:nodeB:start" (retract) separated by commas, "-" for none. A full schedule ("f") replaces all entries,
+#a delta ("d") applies to its base version only, deltas arriving before their base are kept until the base is installed.
+scheduleVersion=0
+declare -a scheduleRecords
+declare -A pendingSchedules
+
+#Checks the signature of schedule record $1 (as kept in scheduleRecords) of the authority
+verifySchedule() {
+	local -a rec=($1)
+	if [ -z "$scheduleKey" ]; then
+		return 1
+	fi
+	printf %s "sc $scheduleAuthority ${rec[0]} ${rec[1]} ${rec[2]} ${rec[3]} ${rec[5]}"|openssl dgst -sha256 -verify $scheduleKey -signature <(base64 -d <<<"${rec[4]}" 2>/dev/null) >/dev/null 2>&1
+}
+
+#Applies the entries of schedule record $1 to the scheduled contacts, all changes reach ION with the next contact plan update
+applySchedule() {
+	local key entry
+	local -a rec=($1) entries fields
+	if [ "${rec[3]}" == "f" ]; then
+		for key in "${!scheduledContacts[@]}"; do
+			if [[ "$key" == "schedule "* ]]; then
+				unset scheduledContacts["$key"]
+			fi
+		done
+		scheduleRecords=()
+		#Early deltas older than the full schedule are not needed any more
+		for key in "${!pendingSchedules[@]}"; do
+			if (( key < ${rec[0]} )); then
+				unset pendingSchedules[$key]
+			fi
+		done
+	fi
+	IFS=',' read -ra entries <<< "${rec[5]}"
+	for entry in "${entries[@]}"; do
+		IFS=':' read -ra fields <<< "${entry:1}"
+		if [ "${entry:0:1}" == "+" ]; then
+			storeSchedule "schedule ${fields[0]} ${fields[1]} ${fields[2]}" "${fields[3]} ${fields[4]}"
+		elif [ "${entry:0:1}" == "-" ] && [ ${#fields[@]} -eq 3 ]; then
+			unset scheduledContacts["schedule ${fields[0]} ${fields[1]} ${fields[2]}"]
+		fi
+	done
+	scheduleVersion=${rec[0]}
+	if [ "$fixedCapacity" == "true" ] && (( ${#scheduleRecords[@]} >= maxScheduleRecords )); then
+		#New neighbors get the deltas only up to here, the rest with the next full schedule
+		((capacityDropCount++))
+	else
+		scheduleRecords+=("$1")
+	fi
+	echo "$(tput setaf 3)Authoritative schedule version $scheduleVersion installed ($([ "${rec[3]}" == "f" ] && echo full || echo delta), ${#entries[@]} entries)$(tput setaf 7)"
+	#Deltas that arrived before this version follow now
+	if [ -n "${pendingSchedules[$scheduleVersion]}" ]; then
+		key=${pendingSchedules[$scheduleVersion]}
+		unset pendingSchedules[$scheduleVersion]
+		applySchedule "$key"
+	fi
+}
+
+#Queues the last full schedule and the deltas since then for neighbor $1
+queueSchedule() {
+	local record
+	local -a rec
+	for record in "${scheduleRecords[@]}"; do
+		rec=($record)
+		queueMessage $1 "$msgidentifier 1 sc $scheduleAuthority $nodeId ${rec[0]} ${rec[1]} ${rec[2]} 1 ${rec[3]} ${rec[4]} ${rec[5]}" sc
+	done
+}
+
+#Authority only: sends the changes of the schedule file as a signed delta, and the full schedule every scheduleSnapshotInterval seconds
+declare -A authoritySchedule
+scheduleFileSum=""
+scheduleSnapshotTime=$((-scheduleSnapshotInterval))
+publishSchedule() {
+	local sum key entries="" kind base ts signature plan
+	local -a line
+	local -A desired
+	sum=$(cksum < $scheduleFile 2>/dev/null)
+	if [ -n "$sum" ] && [ "$sum" != "$scheduleFileSum" ]; then
+		while read -r -a line; do
+			if [[ "${line[0]}" =~ ^[0-9]+$ && "${line[1]}" =~ ^[0-9]+$ && "${line[2]}" =~ ^[0-9]+$ && "${line[3]}" =~ ^[0-9]+$ && "${line[4]:-100000}" =~ ^[0-9]+$ ]] && (( line[1] > line[0] )); then
+				desired["${line[2]} ${line[3]} ${line[0]}"]="${line[1]} ${line[4]:-100000}"
+			elif [ ${#line[@]} -gt 0 ] && [ "${line[0]:0:1}" != "#" ]; then
+				echo "$(tput setaf 1)Invalid schedule line rejected:${line[*]}$(tput setaf 7)"
+			fi
+		done < $scheduleFile
+		for key in "${!authoritySchedule[@]}"; do
+			if [ -z "${desired[$key]}" ]; then
+				entries+=",-${key// /:}"
+			fi
+		done
+		for key in "${!desired[@]}"; do
+			if [ "${desired[$key]}" != "${authoritySchedule[$key]}" ]; then
+				read -r -a line <<< "$key ${desired[$key]}"
+				entries+=",+${line[0]}:${line[1]}:${line[2]}:${line[3]}:${line[4]}"
+			fi
+		done
+		scheduleFileSum=$sum
+		authoritySchedule=()
+		for key in "${!desired[@]}"; do
+			authoritySchedule[$key]=${desired[$key]}
+		done
+		if [ -n "$entries" ]; then
+			kind=d
+			base=$scheduleVersion
+			entries=${entries:1}
+			((scheduleVersion++))
+			{
+				echo $scheduleVersion
+				for key in "${!authoritySchedule[@]}"; do
+					echo "$key ${authoritySchedule[$key]}"
+				done
+			}>$scheduleStateFile
+		fi
+	fi
+	#The first schedule sent after a start is always a full one
+	if [ -z "$kind" ] && (( SECONDS-scheduleSnapshotTime >= scheduleSnapshotInterval )) || [ ${#scheduleRecords[@]} -eq 0 ]; then
+		kind=f
+		base=0
+		entries=""
+		for key in "${!authoritySchedule[@]}"; do
+			read -r -a line <<< "$key ${authoritySchedule[$key]}"
+			entries+=",+${line[0]}:${line[1]}:${line[2]}:${line[3]}:${line[4]}"
+		done
+		entries=${entries:1}
+	fi
+	if [ -z "$kind" ]; then
+		return
+	fi
+	if [ "$kind" == "f" ]; then
+		scheduleSnapshotTime=$SECONDS
+	fi
+	ts=$(date +%s)
+	entries=${entries:--}
+	signature=$(printf %s "sc $nodeId $scheduleVersion $base $ts $kind $entries"|openssl dgst -sha256 -sign $scheduleSigningKey|base64 -w0)
+	applySchedule "$scheduleVersion $base $ts $kind $signature $entries"
+	for plan in "${plans[@]}"; do
+		if [ "$plan" != "$nodeId" ]; then
+			queueMessage $plan "$msgidentifier 1 sc $nodeId $nodeId $scheduleVersion $base $ts 0 $kind $signature $entries" sc
+		fi
+	done
+}
+
+localSubnets=($(ip -o -4 addr show 2>/dev/null|grep -v " lo "|awk '{print $4}'))
+
+ipToInt() {
+	local IFS=.
+	local -a octets=($1)
+	echo $(( (octets[0]<<24)+(octets[1]<<16)+(octets[2]<<8)+octets[3] ))
+}
+
+onLocalSegment() {
+	local subnet net mask ip
+	ip=$(ipToInt $1)
+	for subnet in "${localSubnets[@]}"; do
+		net=$(ipToInt ${subnet%/*})
+		mask=$(( (0xFFFFFFFF<<(32-${subnet#*/})) & 0xFFFFFFFF ))
+		if (( (ip & mask) == (net & mask) )); then
+			return 0
+		fi
+	done
+	return 1
+}
+
+#Finds the neighbors on the local multi-access segment and elects the designated (floodDR) and backup (floodBDR) flooder
+declare -A segmentMembers
+
+electFlooder() {
+	local line node ip
+	local -a candidates
+	segmentMembers=()
+	floodDR=""
+	floodBDR=""
+	if [ "$designatedFlooding" != "true" ]; then
+		return
+	fi
+	if [ -n "$segmentNeighbors" ]; then
+		for node in $segmentNeighbors; do
+			segmentMembers[$node]=1
+		done
+	else
+		while read -r line; do
+			node=$(sed 's@^[^0-9]*\([0-9]\+\).*@\1@' <<<"$line")
+			ip=$(grep -E -o "\b[0-9]+\.[0-9]+\.[0-9]+\.[0-9]+\b" <<<"$line"|head -1)
+			if [[ "$node" =~ ^[0-9]+$ && "$node" != "$nodeId" && -n "$ip" ]] && onLocalSegment $ip; then
+				segmentMembers[$node]=1
+			fi
+		done <<<"$planList"
+	fi
+	if [ ${#segmentMembers[@]} -eq 0 ]; then
+		return
+	fi
+	if (( flooderPriority > 0 )); then
+		candidates+=("$flooderPriority $nodeId")
+	fi
+	for node in "${!segmentMembers[@]}"; do
+		if neighborSupports $node dr && (( ${neighborPriority[$node]:-0} > 0 )); then
+			candidates+=("${neighborPriority[$node]} $node")
+		fi
+	done
+	candidates=($(printf '%s\n' "${candidates[@]}"|sort -k1,1nr -k2,2n|awk '{print $2}'))
+	floodDR=${candidates[0]}
+	floodBDR=${candidates[1]}
+	echo "Segment neighbors:${!segmentMembers[*]}, designated flooder:${floodDR:-none}, backup:${floodBDR:-none}"
+}
+
+#Decides if a message received from msgSentFrom may be forwarded to the segment neighbor $1
+segmentForwardAllowed() {
+	if [ -z "${segmentMembers[$1]}" ] || [ -z "$floodDR" ] || [ "$floodDR" == "$nodeId" ]; then
+		return 0
+	fi
+	#Messages received from the designated flooder were already flooded to the whole segment
+	if [ "$msgSentFrom" == "$floodDR" ]; then
+		return 1
+	fi
+	#Other messages are only handed over to the designated and backup flooder
+	[ "$1" == "$floodDR" ] || [ "$1" == "$floodBDR" ]
+}
+
+
+#Handlers of received messages, called with the message fields in cmdarray
+handleHello() {
+	if [[ "${neighborFeatures[$msgOrigin]}" != "${cmdarray[6]}" ]]; then
+		echo "$(tput setaf 2)Neighbor $msgOrigin supports versions:${cmdarray[5]}, features:${cmdarray[6]}$(tput setaf 7)"
+	fi
+	#A new (or returning) neighbor gets its link database synchronized
+	if [ -z "${neighborHelloTime[$msgOrigin]}" ] || (( SECONDS - ${neighborHelloTime[$msgOrigin]} > 3*updateInterval )); then
+		healNeighbors[$msgOrigin]=1
+	fi
+	neighborFeatures[$msgOrigin]=${cmdarray[6]}
+	neighborHelloTime[$msgOrigin]=$SECONDS
+	neighborPriority[$msgOrigin]=${cmdarray[7]}
+}
+
+handleDigest() {
+	echo "$(tput setaf 2)Digest message received from node $msgSentFrom$(tput setaf 7)"
+	syncWithDigests $msgSentFrom ${cmdarray[5]} ${cmdarray[6]} ${cmdarray[7]} ${cmdarray[8]}
+	loopSleep=$syncInterval
+}
+
+handleNodeInfo() {
+	#Node information is only taken (and forwarded) when its version is newer than the cached one
+	if [ "$msgOrigin" == "$nodeId" ] || (( ${cmdarray[5]} <= ${nodeAttrVersion[$msgOrigin]:-0} )); then
+		return
+	fi
+	if [ "$fixedCapacity" == "true" ] && [ -z "${nodeAttrs[$msgOrigin]}" ] && (( ${#nodeAttrs[@]} >= maxNodes )); then
+		((capacityDropCount++))
+		return
+	fi
+	#Attributes of other nodes get the same character set as our own (attrValue), they end up in the graph labels
+	cmdarray[6]=${cmdarray[6]//[^A-Za-z0-9._:\/+=,-]/_}
+	nodeAttrs[$msgOrigin]=${cmdarray[6]}
+	nodeAttrVersion[$msgOrigin]=${cmdarray[5]}
+	echo "$(tput setaf 2)Node information received[Origin:$msgOrigin,From:$msgSentFrom,Version:${cmdarray[5]}]:${cmdarray[6]}$(tput setaf 7)"
+	forwardMessage na
+}
+
+handleContact() {
+	nodeA=${cmdarray[5]}
+	nodeB=${cmdarray[6]}
+	msgKey="ct $msgOrigin $nodeA $nodeB ${cmdarray[9]} ${cmdarray[7]}"
+	if [ "$msgOrigin" == "$nodeId" ] || [ -n "${seenMessages[$msgKey]}" ]; then
+		return
+	fi
+	markSeen "$msgKey"
+	echo "$(tput setaf 2)Scheduled contact received[Origin:$msgOrigin,From:$msgSentFrom,NodeA:$nodeA,NodeB:$nodeB,Start:${cmdarray[9]},End:${cmdarray[10]}]$(tput setaf 7)"
+	storeSchedule "$msgOrigin $nodeA $nodeB ${cmdarray[9]}" "${cmdarray[10]} ${cmdarray[11]}"
+	forwardMessage ct
+}
+
+handleSchedule() {
+	local record="${cmdarray[5]} ${cmdarray[6]} ${cmdarray[7]} ${cmdarray[9]} ${cmdarray[10]} ${cmdarray[11]}"
+	msgKey="sc $msgOrigin ${cmdarray[5]} ${cmdarray[9]} ${cmdarray[7]}"
+	if [ "$msgOrigin" != "$scheduleAuthority" ] || [ "$msgOrigin" == "$nodeId" ] || (( ${cmdarray[5]} <= scheduleVersion )) || [ -n "${seenMessages[$msgKey]}" ]; then
+		return
+	fi
+	#Only a verified record is marked as seen, a forged copy must not suppress the genuine one
+	if ! verifySchedule "$record"; then
+		echo "$(tput setaf 1)Schedule version ${cmdarray[5]} with invalid signature rejected[From:$msgSentFrom]$(tput setaf 7)"
+		((scheduleRejectedCount++))
+		return
+	fi
+	markSeen "$msgKey"
+	if [ "${cmdarray[9]}" == "f" ] || (( ${cmdarray[6]} == scheduleVersion )); then
+		applySchedule "$record"
+	elif [ "$fixedCapacity" != "true" ] || [ -n "${pendingSchedules[${cmdarray[6]}]}" ] || (( ${#pendingSchedules[@]} < maxScheduleRecords )); then
+		pendingSchedules[${cmdarray[6]}]=$record
+	else
+		((capacityDropCount++))
+	fi
+	forwardMessage sc
+}
+
+#Fragments waiting for the rest of their payload, "from id" -> number of received fragments and time (in SECONDS) of the first,
+#"from id index" -> part of the payload
+declare -A fragmentCount
+declare -A fragmentTime
+declare -A fragmentParts
+
+handleFragment() {
+	local key="$msgSentFrom ${cmdarray[5]}" index=${cmdarray[6]} count=${cmdarray[7]} i payload=""
+	if (( index < 1 || index > count )) || [ -n "${fragmentParts["$key $index"]}" ]; then
+		return
+	fi
+	if [ "$fixedCapacity" == "true" ] && (( ${#fragmentParts[@]} >= maxFragments )); then
+		((capacityDropCount++))
+		return
+	fi
+	#The part is taken from the message text, it may start or end with a space
+	fragmentParts["$key $index"]=${record#"$msgidentifier 1 fr ${cmdarray[3]} $msgSentFrom ${cmdarray[5]} $index $count "}
+	fragmentTime[$key]=${fragmentTime[$key]:-$SECONDS}
+	fragmentCount[$key]=$(( ${fragmentCount[$key]:-0}+1 ))
+	if (( ${fragmentCount[$key]} < count )); then
+		return
+	fi
+	for ((i=1; i<=count; i++)); do
+		payload+=${fragmentParts["$key $i"]}
+		unset fragmentParts["$key $i"]
+	done
+	unset fragmentCount["$key"] fragmentTime["$key"]
+	processPayload "$payload"
+}
+
+#Drops the fragments whose other parts did not arrive within three update intervals
+expireFragments() {
+	local key i
+	for key in "${!fragmentTime[@]}"; do
+		if (( SECONDS - ${fragmentTime[$key]} > 3*updateInterval )); then
+			for i in {1..99}; do
+				unset fragmentParts["$key $i"]
+			done
+			unset fragmentCount["$key"] fragmentTime["$key"]
+		fi
+	done
+}
+
+handleLink() {
+	nodeA=${cmdarray[5]}
+	nodeB=${cmdarray[6]}
+	if [ "$msgOrigin" == "$nodeId" ]; then
+		return
+	fi
+	#The timespan field sets the validity of the link, older nodes do not send it
+	linkTimespan=${cmdarray[9]:-$linkLifetime}
+	msgAge=0
+	if [ -n "${cmdarray[10]}" ]; then
+		#The age field (seconds since the origin sent the message) decides whether the message is newer than the stored one,
+		#copies arriving over slower paths are older. The origin clock (timestamp field) is not used.
+		msgAge=$(( ${cmdarray[10]}+receiveDelay ))
+		read -r _ _ orig <<< "${linkInfo[$msgOrigin $nodeA $nodeB]}"
+		if (( msgAge >= linkTimespan )); then
+			return
+		fi
+		if [ -n "$orig" ] && (( SECONDS-msgAge <= orig+updateInterval/2 )); then
+			return
+		fi
+		cmdarray[10]=$msgAge
+	elif [ -n "${cmdarray[7]}" ]; then
+		#Without the age field the same message is recognized by its timestamp, it is processed only once
+		msgKey="$msgOrigin $nodeA $nodeB ${cmdarray[7]}"
+		if [ -n "${seenMessages[$msgKey]}" ]; then
+			return
+		fi
+		markSeen "$msgKey"
+	fi
+	storeLink "$msgOrigin $nodeA $nodeB" $((SECONDS+linkTimespan-msgAge)) "${cmdarray[7]:-0} ${cmdarray[8]:-0} $((SECONDS-msgAge))"
+	if (( SECONDS+linkTimespan-msgAge > ${originExpiry[$msgOrigin]:-0} )) && originTracked $msgOrigin; then
+		originExpiry[$msgOrigin]=$((SECONDS+linkTimespan-msgAge))
+	fi
+	if [ -n "${lostOrigins[$msgOrigin]}" ]; then
+		echo "$(tput setaf 2)Partition healed, origin $msgOrigin reachable again over node $msgSentFrom$(tput setaf 7)"
+		unset lostOrigins[$msgOrigin]
+		healNeighbors[$msgSentFrom]=1
+	fi
+	echo "$(tput setaf 2)Link message received[Origin:$msgOrigin,From:$msgSentFrom,NodeA:$nodeA,NodeB:$nodeB]$(tput setaf 7)"
+	if linkAdvertised $nodeA $nodeB; then
+		forwardMessage
+	fi
+}
+
+handlePosition() {
+	local ts
+	#Only positions newer than the stored one are taken and forwarded
+	read -r ts _ <<< "${nodePosition[$msgOrigin]}"
+	if [ "$msgOrigin" == "$nodeId" ] || (( ${cmdarray[7]} <= ${ts:-0} )); then
+		return
+	fi
+	if [ "$fixedCapacity" == "true" ] && [ -z "${nodePosition[$msgOrigin]}" ] && (( ${#nodePosition[@]} >= maxNodes )); then
+		((capacityDropCount++))
+		return
+	fi
+	nodePosition[$msgOrigin]="${cmdarray[7]} ${cmdarray[5]} ${cmdarray[6]} ${cmdarray[*]:9:4}"
+	echo "$(tput setaf 2)Position received[Origin:$msgOrigin,From:$msgSentFrom,Lat:${cmdarray[5]},Lon:${cmdarray[6]}]$(tput setaf 7)"
+	forwardMessage po
+}
+
+#Dispatch table of received messages, "version:type" -> handler and layout of the fields after the type
+#Layout rules: n number, N optional number, f decimal number, s text, S optional text; further fields are ignored
+declare -A messageHandlers=(
+	[1:hi]=handleHello
+	[1:dg]=handleDigest
+	[1:na]=handleNodeInfo
+	[1:ct]=handleContact
+	[1:li]=handleLink
+	[1:po]=handlePosition
+	[1:sc]=handleSchedule
+	[1:fr]=handleFragment
+)
+declare -A messageLayouts=(
+	[1:hi]="n n s s N"
+	[1:dg]="n n s s N N"
+	[1:na]="n n n s N N"
+	[1:ct]="n n n n n n n n n"
+	[1:li]="n n n n N N N N"
+	[1:po]="n n f f n n f f f f"
+	[1:sc]="n n n n n n s s s"
+	[1:fr]="n n n n n"
+)
+
+#The layouts are turned into one regular expression per message type when the script starts
+declare -A messagePatterns
+for msgType in "${!messageLayouts[@]}"; do
+	pattern="^"
+	for rule in ${messageLayouts[$msgType]}; do
+		if [ "$rule" == "n" ]; then
+			pattern+="[0-9]+ "
+		elif [ "$rule" == "N" ]; then
+			pattern+="([0-9]+ |$)"
+		elif [ "$rule" == "f" ]; then
+			pattern+="-?[0-9]+(\.[0-9]+)? "
+		elif [ "$rule" == "s" ]; then
+			pattern+="[^ ]+ "
+		else
+			pattern+="([^ ]+ |$)"
+		fi
+	done
+	messagePatterns[$msgType]=$pattern
+done
+
+#Reads the next line from the receive ring into line, waiting up to $1 seconds
+#A line cut by the timeout is kept and completed by the next call
+readRing() {
+	local chunk
+	if read -r -t $1 -u 4 chunk; then
+		line=$ringPartial$chunk
+		ringPartial=""
+		return 0
+	fi
+	ringPartial+=$chunk
+	return 1
+}
+
+#Processes one line printed by bpsink, a line can carry one DTNEX message or a batch of them
+processReceived() {
+	if [[ "$1" != *"$msgidentifier"* ]]; then
+		return
+	fi
+	#bpsink prints the payload enclosed in single quotes, strip them so the fields are clean
+	payload=${1#*\'}
+	payload=${payload%\'*}
+	((receivedMsgCount++))
+	#Corrupted or truncated messages are dropped before they are parsed
+	if [[ "$payload" =~ \ \#([0-9]+)$ ]]; then
+		msgBody=${payload% \#*}
+		if [[ "$(msgChecksum "$msgBody")" != "${BASH_REMATCH[1]}" ]]; then
+			echo "$(tput setaf 1)Message with invalid checksum rejected!$(tput setaf 7)"
+			((rejectedMsgCount++))
+			return
+		fi
+		payload=$msgBody
+	else
+		#Nodes that advertised the crc feature always send the checksum, so a payload without it was truncated.
+		#Only nodes that never sent a hello (older versions) may send messages without checksum.
+		read -r _ _ msgType _ msgSentFrom _ <<< "$payload"
+		if [ "$msgType" == "gz" ] || [[ ",${neighborFeatures[$msgSentFrom]}," == *",crc,"* ]]; then
+			echo "$(tput setaf 1)Message without checksum rejected!$(tput setaf 7)"
+			((rejectedMsgCount++))
+			return
+		fi
+	fi
+	processPayload "$payload"
+}
+
+#Processes the messages of payload $1 (without checksum), a received bundle or a reassembled fragmented payload
+#The handlers get the message fields in cmdarray and the message text in record
+processPayload() {
+	local payload=$1 record
+	local -a records
+	#Compressed batches are unpacked first
+	if [[ "$payload" == "$msgidentifier 1 gz "* ]]; then
+		payload=$(base64 -d <<<"${payload##* }" 2>/dev/null|gunzip 2>/dev/null)
+	fi
+	#A batch carries several messages separated by ";"
+	IFS=';' read -ra records <<< "$payload"
+	for record in "${records[@]}"; do
+		cmdarray=($record)
+		#echo "Command array: ${cmdarray[@]}"
+		#echo "Number of elements in the array: ${#cmdarray[@]}"
+		msgType="${cmdarray[1]}:${cmdarray[2]}"
+		if [ "${cmdarray[0]}" != "$msgidentifier" ]; then
+			continue
+		elif [ -z "${messageHandlers[$msgType]}" ]; then
+			if [[ ",$supportedVersions," == *",${cmdarray[1]},"* ]]; then
+				echo "Unknown command received!"
+			else
+				echo "Unknown version command received!"
+			fi
+		elif ! [[ "${cmdarray[*]:3} " =~ ${messagePatterns[$msgType]} ]]; then
+			echo "$(tput setaf 1)Malformed ${cmdarray[2]} message rejected!$(tput setaf 7)"
+			((rejectedMsgCount++))
+		else
+			msgOrigin=${cmdarray[3]}
+			msgSentFrom=${cmdarray[4]}
+			${messageHandlers[$msgType]}
+		fi
+	done
+}
 
-ionOutput=$(echo "v"|bpadmin)
+ionCall version bpadmin <<<"v"
+ionOutput=$ionReply
 IFS=' ' read -ra versionline <<< $ionOutput
 echo "Using ION Version:$(tput setaf 3)${versionline[1]}$(tput setaf 7)"
 
 #Getting locally registered  endpoints
-bpadminOutput=$(echo "l endpoint"|bpadmin)
-
-#echo "*----------------------------------------------------------------------*"
-#echo "Raw List of ENDPoints:"
-#echo $bpadminOutput
-#echo ""
-#echo "Number of received lines:${#bpadminOutput[@]}"
-
-localEIDs=($(echo "l endpoint"|bpadmin|grep -E -o "\bipn+:[0-9.-]+\.[0-9.-]+\b"))
+ionCall endpoint_list bpadmin <<<"l endpoint"
+localEIDs=($(grep -E -o "\bipn+:[0-9.-]+\.[0-9.-]+\b" <<<"$ionReply"))
 
 echo "Number of registered  EIDs:${#localEIDs[@]}"
 echo "List of local EIDs:"
@@ -54,25 +2045,90 @@ IFS='.' read -ra nodeIdArray <<< ${ipn_array[1]}
 nodeId=${nodeIdArray[0]};
 echo "$(tput setaf 3)Parsed Node ID:$nodeId$(tput setaf 7)"
 
+#Own node information, the version is increased when the information differs from the last run
+ownAttrs="ion=$(attrValue ${versionline[1]}),dtnex=$dtnexVersion"
+for attr in "name=$nodeName" "loc=$nodeLocation" "role=$nodeRole"; do
+	if [ -n "${attr#*=}" ]; then
+		ownAttrs+=",${attr%%=*}=$(attrValue "${attr#*=}")"
+	fi
+done
+ownAttrVersion=0
+if [ -f $nodeInfoFile ]; then
+	read -r ownAttrVersion savedAttrs < $nodeInfoFile
+fi
+if [ "$savedAttrs" != "$ownAttrs" ]; then
+	((ownAttrVersion++))
+	echo "$ownAttrVersion $ownAttrs">$nodeInfoFile
+fi
+echo "Node information (version $ownAttrVersion):$ownAttrs"
+
+#The authority continues with the schedule version it sent last
+if [ -n "$scheduleAuthority" ] && [ -z "$scheduleKey" ]; then
+	echo "$(tput setaf 1)No scheduleKey configured, authoritative schedules are not accepted$(tput setaf 7)"
+fi
+if [ "$scheduleAuthority" == "$nodeId" ] && [ -n "$scheduleFile" ]; then
+	if [ -z "$scheduleSigningKey" ]; then
+		echo "$(tput setaf 1)Schedule authority without scheduleSigningKey, exiting!$(tput setaf 7)"
+		exit 1
+	fi
+	if [ -f $scheduleStateFile ]; then
+		{
+			read -r scheduleVersion
+			while read -r a b start end rate; do
+				authoritySchedule["$a $b $start"]="$end $rate"
+			done
+		} < $scheduleStateFile
+	fi
+	echo "Authoritative schedule (version $scheduleVersion):$scheduleFile"
+fi
+
+#Operator contacts are imported before dtnex installs any contact
+if [ -n "$operatorContacts" ]; then
+	if [ ! -f "$operatorContacts" ]; then
+		echo "$(tput setaf 1)Operator contact file $operatorContacts not found, exiting!$(tput setaf 7)"
+		exit 1
+	fi
+	importOperatorContacts
+fi
+
 
 
 
 #Registering needed endpoints needed to exchange messages, do not change service nrs.
-bpadminOutput1=$(echo "a endpoint ipn:$nodeId.$serviceNr q"|bpadmin)
+ionCall endpoint_add bpadmin <<<"a endpoint ipn:$nodeId.$serviceNr q"
+bpadminOutput1=$ionReply
 #bpadminOutput2=$(echo "a endpoint ipn:$nodeId.$outgoingSerciceNr q"|bpadmin)
 
-#Getting locally registered  endpoints
-bpadminOutput=$(echo "l endpoint"|bpadmin)
 
 
-bpsinkCommand="bpsink ipn:$nodeId.$serviceNr>$capturePipe&"
-echo "Starting bpsink with:$bpsinkCommand"
-bpsink ipn:$nodeId.$serviceNr>$capturePipe&
+if [ -n "$receiveRingDir" ] && [ -d "$receiveRingDir" ]; then
+	#The pipe is opened for reading and writing, so opening it never blocks and a bpsink restart does not end it
+	ringPipe=$receiveRingDir/dtnex-$nodeId.ring
+	rm -f $ringPipe
+	mkfifo -m 600 $ringPipe
+	exec 4<>$ringPipe
+	ringPartial=""
+	#bpsink output to a pipe is block buffered, it has to be line buffered to pass every message right away
+	bpsinkCommand="stdbuf -oL bpsink ipn:$nodeId.$serviceNr>$ringPipe&"
+	echo "Starting bpsink with:$bpsinkCommand"
+	stdbuf -oL bpsink ipn:$nodeId.$serviceNr>$ringPipe&
+else
+	if [ -n "$receiveRingDir" ]; then
+		echo "$(tput setaf 1)Receive ring directory $receiveRingDir not found, using the capture file$(tput setaf 7)"
+	fi
+	ringPipe=""
+	#bpsink appends, so after the capture file is cleared it writes from its start again
+	bpsinkCommand="bpsink ipn:$nodeId.$serviceNr>>$capturePipe&"
+	echo "Starting bpsink with:$bpsinkCommand"
+	bpsink ipn:$nodeId.$serviceNr>>$capturePipe&
+fi
 pid=$!
+lastReceiveTime=$SECONDS
+receiveDelay=0
 
 
 # If this script is killed, kill the child process.
-trap "kill $pid 2> /dev/null" EXIT
+trap "kill $pid 2> /dev/null; rm -f $ringPipe $publishPipe" EXIT
 
 
 # While bpsink is running...
@@ -85,7 +2141,9 @@ while kill -0 $pid 2> /dev/null; do
 	echo "TimeStamp:$TIMESTAMP"
 
 	#echo "Getting a plan list (neighbour  nodes)..."
-	plans=($(echo "l plan"|ipnadmin|sed 's@^[^0-9]*\([0-9]\+\).*@\1@'))
+	ionCall plan_list ipnadmin <<<"l plan"
+	planList=$ionReply
+	plans=($(sed 's@^[^0-9]*\([0-9]\+\).*@\1@' <<<"$planList"))
 	unset plans[-1] # removes the last 1 elements
 	unset plans[-1] # removes the last 1 elements
 	unset plans[-1] # removes the last 1 elements
@@ -96,6 +2154,13 @@ while kill -0 $pid 2> /dev/null; do
 	done
 
 
+	loopSleep=$updateInterval
+	electFlooder
+	expireSeenMessages
+	expireFragments
+	expireLinks
+	detectPartitions
+
 #        echo "Exchanging messages with configured plans:"
 
 	for i in "${plans[@]}"; do
@@ -103,78 +2168,131 @@ while kill -0 $pid 2> /dev/null; do
 	if [[ "$nodeId" == "$plan" ]]; then
 		echo "Skipping local loopback plan"
 	else
+		queueMessage $plan "$msgidentifier 1 hi $nodeId $nodeId $supportedVersions $supportedFeatures $flooderPriority"
+		sendLink=1
+		linkTimespan=$linkLifetime
+		#Static links are refreshed only every staticRefreshInterval seconds
+		if [[ " $staticLinks " == *" $plan "* ]]; then
+			linkTimespan=$staticLinkLifetime
+			if [ -n "${staticRefreshTime[$plan]}" ] && (( SECONDS - ${staticRefreshTime[$plan]} < staticRefreshInterval )); then
+				sendLink=0
+			else
+				staticRefreshTime[$plan]=$SECONDS
+			fi
+		fi
+		#A flapping link is still stored locally, so its penalty keeps being tracked
+		if [ $sendLink -eq 1 ] && ! linkAdvertised $nodeId $plan; then
+			storeLink "$nodeId $nodeId $plan" $((SECONDS+linkTimespan)) "0 0 $SECONDS"
+			sendLink=0
+		fi
+		if [ $sendLink -eq 1 ]; then
   		echo "$(tput setaf 3)Messaging own plan to node [Origin:$nodeId, From:$nodeId, To:$plan, About:$nodeId]$(tput setaf 7)"
-		bpsourceCommand="bpsource ipn:$plan.$serviceNr \"$msgidentifier 1 li $nodeId $nodeId $nodeId $plan\""
-		#echo $bpsourceCommand
-		eval $bpsourceCommand
+		#The age field decides the freshness, the timestamp is sent as 0, so the message fits into one bundle
+		#even with 9 digit node numbers (see Bundle Size Limit)
+		ownMsg="$msgidentifier 1 li $nodeId $nodeId $nodeId $plan 0 0 $linkTimespan 0"
+		queueMessage $plan "$ownMsg"
+		storeLink "$nodeId $nodeId $plan" $((SECONDS+linkTimespan)) "0 0 $SECONDS"
+		#As designated flooder our own link messages are flooded to the whole segment
+		if [ "$floodDR" == "$nodeId" ]; then
+			for member in "${!segmentMembers[@]}"; do
+				if [ "$member" != "$plan" ]; then
+					queueMessage $member "$ownMsg"
+				fi
+			done
+		fi
+		fi
 	fi
 	done
 
-	#Processing received network messages
-
-
-	cat $capturePipe|while read -r line
-	do
-  	#echo "$(tput setaf 5)Received line:$line"
-	if grep -q $msgidentifier <<<$line; then
-	    	#Routing message received, processing received command
-		#echo "$(tput setaf 5)Routing message received, processing..."
-		cmdarray=($line)
-		#echo "Command array: ${cmdarray[@]}"
-		#echo "Number of elements in the array: ${#cmdarray[@]}"
-		if [[ "${cmdarray[1]}" == "1" ]];then
-			#echo "Version 1 command detected, parsing command..."
-			if [[ "${cmdarray[2]}" == "li" ]];then
-				msgOrigin=${cmdarray[3]}
-				msgSentFrom=${cmdarray[4]}
-				nodeA=${cmdarray[5]}
-				nodeB=${cmdarray[6]}
-				echo "$(tput setaf 2)Link message received[Origin:$msgOrigin,From:$msgSentFrom,NodeA:$nodeA,NodeB:$nodeB], updation ION...$(tput setaf 7)"
-                		ionadminCommandContact1="echo \"a contact +1 +3600000 $nodeA $nodeB 100000\"|ionadmin"
-                		#echo $ionadminCommandContact1
-				eval  $ionadminCommandContact1 >/dev/null
-				ionadminCommandContact2="echo \"a contact +1 +3600000 $nodeB $nodeA 100000\"|ionadmin"
-                                #echo $ionadminCommandContact2
-                                eval $ionadminCommandContact2>/dev/null
-				ionadminCommandRange1="echo \"a range +1 +3600000 $nodeA $nodeB 1\"|ionadmin"
-                                #echo $ionadminCommandRange1
-                                eval $ionadminCommandRange1>/dev/null
-                                ionadminCommandRange2="echo \"a range +1 +3600000 $nodeB $nodeA 1\"|ionadmin"
-                                #echo $ionadminCommandRange2
-                                eval $ionadminCommandRange2>/dev/null
-				#echo "We forward information to all neigboors, except to the node that send or create link message..."
-			        for out in "${plans[@]}"; do
-        				outd=${out:0}
-        				if [ "$msgOrigin" == "$outd" ] || [ "$msgSentFrom" == "$outd" ]  || [ "$nodeId" == "$outd" ] ; then
-                				#echo "Skipping sending message to ourself or to the msg source node:$msgOrigin that sent us this message..."
-        					a=0
-					else
-                				echo "$(tput setaf 5)Forwarding message[Origin:$msgOrigin,From:$msgSentFrom,To:$outd,NodeA:$nodeA,NodeB:$nodeB]$(tput setaf 7)"
-                				bpsourceForwardCommand="bpsource ipn:$out.$serviceNr \"$msgidentifier 1 li $msgOrigin $nodeId $nodeA $nodeB\""
-                				#echo $bpsourceForwardCommand
-                				eval $bpsourceForwardCommand>/dev/null
-        				fi
-        			done
+	#Own position, sent to the neighbors supporting position records
+	if [ -n "$positionSource" ]; then
+		readPosition
+		if [ -n "$ownPosition" ]; then
+			positionTime=$(date +%s)
+			nodePosition[$nodeId]="$positionTime $ownPosition"
+			for plan in "${plans[@]}"; do
+				if [ "$plan" != "$nodeId" ]; then
+					queueMessage $plan "$msgidentifier 1 po $nodeId $nodeId ${ownPosition% * * * *} $positionTime 0 ${ownPosition#* * }" po
+				fi
+			done
+		fi
+	fi
 
-			else
-                        	echo "Unknown command received!"
+	#Records published by local processes
+	processPublished
 
-			fi
-		else
-			echo "Unknown version command received!"
-		fi
-	#else
-	#	echo "Unknown message received!"
+	#Authoritative schedule changes, on the authority only
+	if [ "$scheduleAuthority" == "$nodeId" ] && [ -n "$scheduleFile" ]; then
+		publishSchedule
 	fi
 
+	#Processing received network messages
+
 
+	#Messages waited in the capture file for half of the time since it was last read on average, this adds to their age
+	if [ -n "$ringPipe" ]; then
+		receiveDelay=0
+		while readRing 0.01; do
+			processReceived "$line"
+		done
+	else
+		receiveDelay=$(( (SECONDS-lastReceiveTime)/2 ))
+		while read -r -u 3 line; do
+			processReceived "$line"
+		done 3<$capturePipe
+		#Cleared right after reading, messages bpsink writes while the loop goes on wait for the next loop
+		>$capturePipe
+		lastReceiveTime=$SECONDS
+	fi
 
+	#Targeted digest exchange with new neighbors and neighbors over which a partition healed
+	for neighbor in "${!healNeighbors[@]}"; do
+		if neighborSupports $neighbor digest; then
+			echo "$(tput setaf 3)Synchronizing link database with node $neighbor$(tput setaf 7)"
+			queueDigest $neighbor q
+			loopSleep=$syncInterval
+		fi
+		queueNodeInfo $neighbor
+		queueSchedule $neighbor
+	done
+	healNeighbors=()
 
+	#Sending the queued messages, batched per neighbor when the neighbor supports it, within the budget of this loop
+	neighborSent=()
+	flushQueues
 
-	done 
+	#Applying the link database changes to ION, flapping links are held down
+	if [ "$flapDamping" == "true" ]; then
+		dampFlaps
+	fi
+	if [ "$positionPrediction" == "true" ] && [ ${#nodePosition[@]} -ge 2 ]; then
+		predictContacts
+	fi
+	updateContactPlan
+	if [ $compactRequested -eq 1 ]; then
+		compactContactPlan
+	fi
+	publishSnapshots
+	runHooks
 
-	#Clear the capture pipe
-    	>$capturePipe
+	echo "Received messages:$receivedMsgCount, rejected messages:$rejectedMsgCount"
+	echo "dtnex_received_messages_total $receivedMsgCount">$metricsFile
+	echo "dtnex_rejected_messages_total $rejectedMsgCount">>$metricsFile
+	echo "dtnex_published_records_total $publishedCount">>$metricsFile
+	echo "dtnex_published_rejected_total $publishRejectedCount">>$metricsFile
+	echo "dtnex_published_dropped_total $publishDroppedCount">>$metricsFile
+	echo "dtnex_hook_dropped_changes_total $hookDroppedCount">>$metricsFile
+	echo "dtnex_capacity_dropped_total $capacityDropCount">>$metricsFile
+	echo "dtnex_link_flaps_total $flapCount">>$metricsFile
+	echo "dtnex_suppressed_links ${#suppressedLinks[@]}">>$metricsFile
+	echo "dtnex_operator_merged_links ${#mergedLinks[@]}">>$metricsFile
+	echo "dtnex_superseded_records_total $supersededCount">>$metricsFile
+	writeOriginMetrics
+	if [ -n "$scheduleAuthority" ]; then
+		echo "dtnex_schedule_version $scheduleVersion">>$metricsFile
+		echo "dtnex_schedule_rejected_total $scheduleRejectedCount">>$metricsFile
+	fi
+	writeIonMetrics
 
 	if [ -n "$createGraph" ]; then
   		echo "Generating new graph visualization..."
@@ -185,11 +2303,12 @@ while kill -0 $pid 2> /dev/null; do
 
  	#echo "*----------------------------------------------------------------------*"
  	echo "$(tput setaf 6)Updated Contact Graph List:"
- 	contlist=$(echo "l contact"|ionadmin|grep -o -P '(?<=from).*?(?=is)')
+ 	ionCall contact_list ionadmin <<<"l contact"
+ 	contlist=$(grep -o -P '(?<=from).*?(?=is)' <<<"$ionReply")
  	for li in "${contlist[@]}"; do
 	    	echo "$li"
 
-  		if [ -n "$createGraph" ]; then
+  		if [ -n "$createGraph" ] && (( installHopLimit == 0 )); then
 
 		readarray -t pairline <<<"$li"
 		for pline in "${pairline[@]}"; do
@@ -202,15 +2321,49 @@ while kill -0 $pid 2> /dev/null; do
 
 
 	done
+
+	#With a hop limit ION holds only a part of the topology, the graph is drawn from the full link database
+	if [ -n "$createGraph" ] && (( installHopLimit > 0 )); then
+		for key in "${!linkDb[@]}"; do
+			read -r _ a b <<< "$key"
+			echo "\"ipn:$a\" -> \"ipn:$b\""
+			echo "\"ipn:$b\" -> \"ipn:$a\""
+		done|sort -u>>contactGraph.gv
+	fi
+
+	#Nodes with a name are labeled with it
+	if [ -n "$createGraph" ]; then
+		for origin in "${!nodeAttrs[@]}" $nodeId; do
+			if [ "$origin" == "$nodeId" ]; then
+				attrs=$ownAttrs
+			else
+				attrs=${nodeAttrs[$origin]}
+			fi
+			if [[ ",$attrs" =~ ,name=([^,]*) ]]; then
+				echo "\"ipn:$origin\" [label=\"ipn:$origin\\n${BASH_REMATCH[1]}\"]">>contactGraph.gv
+			fi
+		done
+	fi
 	
         if [ -n "$createGraph" ]; then
 	echo "labelloc=\"t\"; label=\"IPNSIG Network Graph, Updated:$TIMESTAMP\"}">>contactGraph.gv
 	dot -Tpng contactGraph.gv -o $graphFile
 	fi    	
 
-	echo "$(tput setaf 7)Sleep for $updateInterval sec..."
+	echo "$(tput setaf 7)Sleep for $loopSleep sec..."
 	echo
-	sleep $updateInterval
+	if [ -n "$ringPipe" ]; then
+		#Messages received during the sleep are processed and forwarded as soon as they arrive
+		sleepEnd=$((SECONDS+loopSleep))
+		while (( SECONDS < sleepEnd )); do
+			if readRing $((sleepEnd-SECONDS)); then
+				processReceived "$line"
+				flushQueues
+			fi
+		done
+	else
+		sleep $loopSleep
+	fi
 
 done
 
@@ -218,4 +2371,8 @@ done
 # Disable the trap on a normal exit.
 trap - EXIT
 
-
+# Remove the receive ring and the publish pipe, bpsink ended.
+if [ -n "$ringPipe" ]; then
+	rm -f $ringPipe
+fi
+rm -f $publishPipe
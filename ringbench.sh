@@ -0,0 +1,75 @@
+#!/bin/bash
+# DTNEX receive ring benchmark
+# Measures the latency from bpsink output to the dtnex processor, over the capture file and over the receive ring
+# Runs without ION, a writer process takes the place of bpsink
+
+#Number of messages per run and pause (in seconds) between two messages
+messages=200
+messageInterval=0.02
+#The capture file is read this often (in seconds), dtnex reads it once per loop
+filePoll=1
+#Shared memory directory of the receive ring
+receiveRingDir=/dev/shm
+
+#Modes: file (capture file), ring (named pipe in receiveRingDir)
+modes="file ring"
+
+echo "Starting a DTNEX receive ring benchmark..."
+
+workDir=$(mktemp -d)
+ringPipe=$receiveRingDir/dtnexbench-$$.ring
+trap "rm -rf $workDir $ringPipe" EXIT
+
+#Writes the benchmark messages in the bpsink output format, every message carries its send time (in us)
+writeMessages() {
+	local i
+	for ((i=0; i<messages; i++)); do
+		printf "\t'xmsg 1 bench %s'\n" "${EPOCHREALTIME/[.,]/}"
+		sleep $messageInterval
+	done
+}
+
+#Prints the latency (in us) of the message in line $1
+latency() {
+	local sent=${1##* }
+	sent=${sent%\'}
+	echo $(( ${EPOCHREALTIME/[.,]/}-sent ))
+}
+
+for mode in $modes; do
+	>$workDir/latencies
+	if [ "$mode" == "file" ]; then
+		>$workDir/capture
+		writeMessages>>$workDir/capture &
+		writer=$!
+		exec 3<$workDir/capture
+		received=0
+		while (( received < messages )); do
+			while read -r -u 3 line; do
+				latency "$line">>$workDir/latencies
+				((received++))
+			done
+			if (( received < messages )); then
+				sleep $filePoll
+			fi
+		done
+		exec 3<&-
+	else
+		rm -f $ringPipe
+		mkfifo -m 600 $ringPipe
+		exec 4<>$ringPipe
+		writeMessages>$ringPipe &
+		writer=$!
+		for ((received=0; received<messages; received++)); do
+			read -r -u 4 line
+			latency "$line">>$workDir/latencies
+		done
+		exec 4<&-
+	fi
+	wait $writer
+	sort -n $workDir/latencies|awk -v mode=$mode '{l[NR]=$1; sum+=$1} END {
+		p99=int(NR*0.99)+1
+		if (p99 > NR) p99=NR
+		printf "Mode:%s, messages:%d, latency avg:%.2fms, median:%.2fms, p99:%.2fms, max:%.2fms\n", mode, NR, sum/NR/1000, l[int(NR/2)+1]/1000, l[p99]/1000, l[NR]/1000
+	}'
+done
@@ -0,0 +1,85 @@
+#!/bin/bash
+# DTNEX snapshot benchmark
+# Measures the reader throughput of the dtnex table snapshots while a writer keeps replacing them
+# Runs without ION, the snapshots are written the same way as by dtnex.sh (temporary file renamed over the old one)
+
+#Number of concurrent readers
+readers=4
+#Duration (in seconds) of every run
+duration=10
+#Number of lines of the benchmark table (e.g. installed links)
+tableSize=500
+#Pause (in seconds) between two new versions written by the writer, 0 writes as fast as possible
+writeInterval=0
+
+#Modes: rename (as dtnex.sh), inplace (the file is rewritten in place, for comparison)
+modes="rename inplace"
+
+echo "Starting a DTNEX snapshot benchmark..."
+
+workDir=$(mktemp -d)
+trap "rm -rf $workDir" EXIT
+
+#Writes version $2 of the table to $workDir/contacts, mode $1
+writeTable() {
+	local i
+	if [ "$1" == "rename" ]; then
+		{
+			echo "#dtnex contacts epoch $2 time $(date +%s)"
+			for ((i=0; i<tableSize; i++)); do
+				echo "link $((i+$2%7)) $((i+1))"
+			done
+			echo "#end epoch $2"
+		}>$workDir/.contacts.tmp
+		mv -f $workDir/.contacts.tmp $workDir/contacts
+	else
+		{
+			echo "#dtnex contacts epoch $2 time $(date +%s)"
+			for ((i=0; i<tableSize; i++)); do
+				echo "link $((i+$2%7)) $((i+1))"
+			done
+			echo "#end epoch $2"
+		}>$workDir/contacts
+	fi
+}
+
+#Reads the table until $1 (unix time) and writes "reads torn" to $2, a read is torn when its header and trailer epochs differ
+readTable() {
+	local -a lines header trailer
+	local reads=0 torn=0
+	while (( $(date +%s) < $1 )); do
+		mapfile -t lines <$workDir/contacts
+		((reads++))
+		header=(${lines[0]})
+		trailer=(${lines[@]: -1})
+		if [ ${#lines[@]} -ne $((tableSize+2)) ] || [ "${header[3]}" != "${trailer[2]}" ]; then
+			((torn++))
+		fi
+	done
+	echo "$reads $torn">$2
+}
+
+for mode in $modes; do
+	writeTable rename 0
+	end=$(( $(date +%s)+duration ))
+	for ((r=0; r<readers; r++)); do
+		readTable $end $workDir/reader$r &
+	done
+	epoch=0
+	while (( $(date +%s) < end )); do
+		((epoch++))
+		writeTable $mode $epoch
+		if [ "$writeInterval" != "0" ]; then
+			sleep $writeInterval
+		fi
+	done
+	wait
+	totalReads=0
+	totalTorn=0
+	for ((r=0; r<readers; r++)); do
+		read -r reads torn <$workDir/reader$r
+		((totalReads+=reads))
+		((totalTorn+=torn))
+	done
+	echo "$(tput setaf 2)Mode:$mode, readers:$readers, versions written:$epoch, reads:$totalReads ($((totalReads/duration))/s), torn reads:$totalTorn$(tput setaf 7)"
+done